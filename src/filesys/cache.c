@@ -1,236 +1,701 @@
 #include "filesys/cache.h"
 #include <debug.h>
 #include <list.h>
+#include <round.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-
-static struct cache_entry cache[CACHE_SIZE];
+#include "threads/vaddr.h"
+
+/* Cached sectors per page of sector data. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The entries, of which the first CACHE_CNT are in use.  Entry I
+   keeps its data in page I / SECTORS_PER_PAGE of CACHE_PAGES.
+   The pages come from the user pool, so that the cache competes with
+   process frames for memory and can give pages back to them; see
+   cache_shrink(). */
+static struct cache_entry* cache;
+static uint8_t** cache_pages;
+static size_t cache_cnt;
 static struct lock cache_lock;
 
-static struct list read_ahead_list;
+/* Sector -> entry index over the valid and in-flight entries.
+   Protected by cache_lock. */
+static struct hash cache_index;
+
+/* Signaled on cache_lock whenever an entry finishes its I/O
+   or drops its last pin. */
+static struct condition cache_idle;
+
+/* Clock hand, the next entry cache_find_victim() looks at. */
+static size_t cache_hand;
+
+/* Sector of the most recent access.  Back-to-back accesses to the
+   same sector (e.g. small sequential reads) are one correlated
+   reference and earn no extra second chance, so a scan cannot make
+   its sectors look as hot as reused metadata. */
+static block_sector_t cache_last_sector = BLOCK_SECTOR_ERROR;
+
+/* Number of entries holding read-ahead data nobody has used yet. */
+static size_t cache_prefetched;
+
+/* Ring of sectors queued for the read-ahead daemon. */
+static block_sector_t read_ahead_queue[CACHE_READ_AHEAD_QUEUE];
+static size_t read_ahead_head;
+static size_t read_ahead_cnt;
 static struct lock read_ahead_lock;
 static struct condition read_ahead_cond;
 static void cache_read_ahead_daemon(void *aux UNUSED);
 
-static struct list write_behind_list;
-static struct lock write_behind_lock;
+/* Dirty entries in ascending sector order, so that neighbours
+   that can share one disk request sit next to each other.
+   Protected by cache_lock. */
+static struct list cache_dirty;
+
+/* Requests to the write-behind daemon.  Protected by cache_lock. */
+static bool write_behind_stop;  /* Exit at the next wakeup. */
+static bool write_behind_all;   /* Next pass ignores CACHE_DIRTY_AGE. */
 static void cache_write_behind_daemon(void *aux UNUSED);
 
-static struct cache_entry* cache_pull(block_sector_t sector);
+static struct cache_entry* cache_pull(block_sector_t sector,
+    enum cache_mode mode);
+static struct cache_entry* cache_lookup(block_sector_t sector);
+static void cache_unpin(struct cache_entry* entry);
 static struct cache_entry* cache_find_victim(void);
-static void cache_evict(struct cache_entry* victim);
+static void cache_set_dirty(struct cache_entry* entry);
+static bool cache_writable(const struct cache_entry* entry);
+static block_sector_t cache_write_run(struct cache_entry* first);
+static void cache_load(struct cache_entry* entry, block_sector_t sector,
+    bool fill);
+static void cache_prefetch(block_sector_t sector);
+
+static unsigned
+cache_hash(const struct hash_elem* e, void* aux UNUSED)
+{
+  struct cache_entry* entry = hash_entry(e, struct cache_entry, elem);
+  return hash_int((int) entry->sector);
+}
 
+static bool
+cache_less(const struct hash_elem* a, const struct hash_elem* b,
+    void* aux UNUSED)
+{
+  struct cache_entry* entry_a = hash_entry(a, struct cache_entry, elem);
+  struct cache_entry* entry_b = hash_entry(b, struct cache_entry, elem);
+  return entry_a->sector < entry_b->sector;
+}
+
+static bool
+cache_dirty_less(const struct list_elem* a, const struct list_elem* b,
+    void* aux UNUSED)
+{
+  struct cache_entry* entry_a = list_entry(a, struct cache_entry, dirty_elem);
+  struct cache_entry* entry_b = list_entry(b, struct cache_entry, dirty_elem);
+  return entry_a->sector < entry_b->sector;
+}
+
+/* Sets up a cache of SIZE sectors, rounded up to whole pages and
+   to at least CACHE_MIN_SIZE, but at most 1/CACHE_POOL_DIV of the
+   free user pool.  Only the VM kernel gives cache pages back to
+   processes (see cache_shrink()), so without the cap a large -cache
+   would leave the other kernels no memory to run programs in.  The
+   cap also keeps the sizes below from overflowing. */
 void 
-cache_init(void) 
+cache_init(size_t size) 
 {
-  for (size_t i = 0; i < CACHE_SIZE; ++i) 
+  size_t max_size = palloc_free_cnt(PAL_USER) / CACHE_POOL_DIV
+                    * SECTORS_PER_PAGE;
+  if (size > max_size)
+    size = max_size;
+  if (size < CACHE_MIN_SIZE)
+    size = CACHE_MIN_SIZE;
+  size_t page_cnt = DIV_ROUND_UP(size, SECTORS_PER_PAGE);
+
+  cache = malloc(page_cnt * SECTORS_PER_PAGE * sizeof *cache);
+  cache_pages = malloc(page_cnt * sizeof *cache_pages);
+  if (cache == NULL || cache_pages == NULL)
+    PANIC ("buffer cache: out of memory for %zu sectors", size);
+
+  for (size_t p = 0; p < page_cnt; ++p)
+    {
+      enum palloc_flags flags = PAL_USER;
+      if (p * SECTORS_PER_PAGE < CACHE_MIN_SIZE)
+        flags |= PAL_ASSERT;
+      cache_pages[p] = palloc_get_page(flags);
+      if (cache_pages[p] == NULL)
+        break;
+      cache_cnt += SECTORS_PER_PAGE;
+    }
+
+  for (size_t i = 0; i < cache_cnt; ++i) 
     {
-      cache[i].sector = -1;
+      cache[i].data = cache_pages[i / SECTORS_PER_PAGE]
+                      + i % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+      cache[i].sector = BLOCK_SECTOR_ERROR;
       cache[i].dirty = false;
+      cache[i].dirty_tick = 0;
       cache[i].valid = false;
-      cache[i].accessed = false;
+      cache[i].uses = 0;
+      cache[i].pin_cnt = 0;
+      cache[i].io = false;
+      cache[i].prefetched = false;
       lock_init(&cache[i].lock);
+      cond_init(&cache[i].io_done);
     }
   lock_init(&cache_lock);
+  hash_init(&cache_index, cache_hash, cache_less, NULL);
+  cond_init(&cache_idle);
 
-  list_init(&read_ahead_list);
   lock_init(&read_ahead_lock);
   cond_init(&read_ahead_cond);
   thread_create("cache_read_ahead_daemon", PRI_DEFAULT, 
       cache_read_ahead_daemon, NULL, NOT_A_FD);
 
-  list_init(&write_behind_list);
-  lock_init(&write_behind_lock);
+  list_init(&cache_dirty);
   thread_create("cache_write_behind_daemon", PRI_DEFAULT,
       cache_write_behind_daemon, NULL, NOT_A_FD);
 }
 
+/* Pins the cached copy of SECTOR and returns it with its lock held,
+   so the caller can work on its DATA in place.  MODE says what the
+   caller will do: with CACHE_WRITE or CACHE_OVERWRITE the sector is
+   marked dirty, and with CACHE_OVERWRITE a miss does not read the old
+   contents from disk, so the caller must fill in all of DATA.
+   Every cache_get() must be paired with a cache_put(). */
+struct cache_entry*
+cache_get(block_sector_t sector, enum cache_mode mode)
+{
+  return cache_pull(sector, mode);
+}
+
+/* Marks ENTRY, obtained with CACHE_READ, dirty after the caller
+   decided to modify it in place. */
+void
+cache_mark_dirty(struct cache_entry* entry)
+{
+  ASSERT (lock_held_by_current_thread(&entry->lock));
+
+  lock_acquire(&cache_lock);
+  cache_set_dirty(entry);
+  lock_release(&cache_lock);
+}
+
+/* Releases ENTRY, obtained from cache_get(). */
+void
+cache_put(struct cache_entry* entry)
+{
+  lock_release(&entry->lock);
+  cache_unpin(entry);
+}
+
 void 
 cache_read(block_sector_t sector, void *buffer) 
 {
-  struct cache_entry* entry = cache_pull(sector);
-  lock_acquire(&entry->lock);
+  struct cache_entry* entry = cache_get(sector, CACHE_READ);
   memcpy(buffer, entry->data, BLOCK_SECTOR_SIZE);
-  entry->accessed = true;
-  lock_release(&entry->lock);
+  cache_put(entry);
 }
 
 void
 cache_write(block_sector_t sector, const void *buffer) 
 {
-  struct cache_entry* entry = cache_pull(sector);
-  lock_acquire(&entry->lock);
+  struct cache_entry* entry = cache_get(sector, CACHE_OVERWRITE);
   memcpy(entry->data, buffer, BLOCK_SECTOR_SIZE);
-  entry->accessed = true;
-  entry->dirty = true;
-  lock_release(&entry->lock);
+  cache_put(entry);
 }
 
+/* Writes every dirty sector to disk, waiting for sectors that are
+   pinned or already being written.  The caller must not have any
+   entry pinned. */
 void
 cache_flush(void) 
 {
   lock_acquire(&cache_lock);
-  for (size_t i = 0; i < CACHE_SIZE; ++i) 
+  while (!list_empty(&cache_dirty))
     {
-      if (cache[i].valid && cache[i].dirty) 
+      struct cache_entry* first = NULL;
+      for (struct list_elem* e = list_begin(&cache_dirty);
+           e != list_end(&cache_dirty); e = list_next(e))
         {
-          block_write(fs_device, cache[i].sector, cache[i].data);
-          cache[i].dirty = false;
+          struct cache_entry* entry
+            = list_entry(e, struct cache_entry, dirty_elem);
+          if (cache_writable(entry))
+            {
+              first = entry;
+              break;
+            }
         }
+      if (first != NULL)
+        cache_write_run(first);
+      else
+        cond_wait(&cache_idle, &cache_lock);
     }
   lock_release(&cache_lock);
 }
 
+/* Returns the entry caching SECTOR, pinned and with its lock held,
+   reading the sector from disk on a miss unless MODE is
+   CACHE_OVERWRITE.  The caller releases the lock and then calls
+   cache_unpin().  Unless MODE is CACHE_READ, the entry is marked
+   dirty before the caller gets to modify it, so that a concurrent
+   write-back always sees the pending write.
+   Disk I/O is done without holding cache_lock; other threads that
+   want the same sector meanwhile wait on the entry's IO_DONE
+   instead of issuing a second read. */
 static struct cache_entry*
-cache_pull(block_sector_t sector) 
+cache_pull(block_sector_t sector, enum cache_mode mode) 
 {
   ASSERT (sector != BLOCK_SECTOR_ERROR);
 
   lock_acquire(&cache_lock);
-  for (size_t i = 0; i < CACHE_SIZE; ++i) 
+  while (true)
     {
-      if (cache[i].valid && cache[i].sector == sector)
-      {
-        lock_release(&cache_lock);
-        return &cache[i];
-      }    
+      struct cache_entry* entry = cache_lookup(sector);
+      if (entry != NULL)
+        {
+          if (entry->io)
+            {
+              cond_wait(&entry->io_done, &cache_lock);
+              continue;
+            }
+          entry->pin_cnt++;
+          if (entry->prefetched)
+            {
+              /* First real use of read-ahead data. */
+              entry->prefetched = false;
+              cache_prefetched--;
+            }
+          else if (sector != cache_last_sector
+                   && entry->uses < CACHE_MAX_USES)
+            entry->uses++;
+          cache_last_sector = sector;
+          if (mode != CACHE_READ)
+            cache_set_dirty(entry);
+          lock_release(&cache_lock);
+
+          /* Pinned, so it keeps caching SECTOR while we wait. */
+          lock_acquire(&entry->lock);
+          return entry;
+        }
+
+      struct cache_entry* victim = cache_find_victim();
+      if (victim == NULL)
+        {
+          /* Every entry is pinned or has I/O in flight. */
+          cond_wait(&cache_idle, &cache_lock);
+          continue;
+        }
+      if (victim->dirty)
+        {
+          /* Write back under the old sector, along with its dirty
+             neighbours, so that readers of it keep finding the entry
+             until the disk is up to date.  Then look again since the
+             world may have changed. */
+          cache_write_run(victim);
+          continue;
+        }
+      if (mode != CACHE_OVERWRITE)
+        {
+          cache_load(victim, sector, true);
+          /* The lookup right after this is the same reference. */
+          cache_last_sector = sector;
+          continue;
+        }
+
+      /* Nothing worth reading: hand the entry out right away, its
+         lock taken before anyone else can see the stale contents. */
+      cache_load(victim, sector, false);
+      cache_last_sector = sector;
+      victim->pin_cnt++;
+      cache_set_dirty(victim);
+      lock_acquire(&victim->lock);
+      lock_release(&cache_lock);
+      return victim;
     }
-  
-  struct cache_entry* victim = cache_find_victim();
-  cache_evict(victim);
-  block_read(fs_device, sector, victim->data);
-  victim->sector = sector;
-  victim->valid = true;
+}
+
+/* Returns the entry indexed under SECTOR, or a null pointer. */
+static struct cache_entry*
+cache_lookup(block_sector_t sector)
+{
+  ASSERT (lock_held_by_current_thread(&cache_lock));
+
+  /* Static, as a whole entry is too big for the kernel stack;
+     cache_lock serializes its use. */
+  static struct cache_entry key;
+  key.sector = sector;
+  struct hash_elem* e = hash_find(&cache_index, &key.elem);
+  return e != NULL ? hash_entry(e, struct cache_entry, elem) : NULL;
+}
+
+/* Drops a pin taken by cache_pull(). */
+static void
+cache_unpin(struct cache_entry* entry)
+{
+  lock_acquire(&cache_lock);
+  ASSERT (entry->pin_cnt > 0);
+  if (--entry->pin_cnt == 0)
+    cond_broadcast(&cache_idle, &cache_lock);
   lock_release(&cache_lock);
-  return victim;
 }
 
+/* Picks an entry to reuse, or returns a null pointer if every entry
+   is pinned or busy with I/O.  Runs a generalized clock: the hand
+   keeps its position across calls, skips pinned and IO entries, and
+   takes one second chance away from each entry it passes until it
+   finds one with none left.  Newly loaded entries start with no
+   second chances, so sectors touched once by a large sequential
+   read go before reused metadata (inodes, indirect blocks, the free
+   map) that has built up to CACHE_MAX_USES. */
 static struct cache_entry*
 cache_find_victim(void) 
 {
   ASSERT (lock_held_by_current_thread(&cache_lock));
 
   // Find an invalid entry
-  for (size_t i = 0; i < CACHE_SIZE; ++i)
+  for (size_t i = 0; i < cache_cnt; ++i)
     {
-      if (!cache[i].valid) 
+      if (!cache[i].valid && !cache[i].io && cache[i].pin_cnt == 0) 
         return &cache[i];
     }    
 
   // Clock algorithm
-  for (size_t i = 0; i < CACHE_SIZE; ++i)
+  for (size_t i = 0; i < (CACHE_MAX_USES + 1) * cache_cnt; ++i)
     {
-      if (cache->accessed)
-        cache->accessed = false;
+      struct cache_entry* entry = &cache[cache_hand];
+      cache_hand = (cache_hand + 1) % cache_cnt;
+
+      if (entry->io || entry->pin_cnt > 0)
+        continue;
+      if (entry->uses > 0)
+        entry->uses--;
       else
-        return &cache[i];
+        return entry;
     }
-
-  // Fallback to the first entry
-  return &cache[0];
+  return NULL;
 }
 
+/* Marks ENTRY dirty.  A sector's age counts from the first write
+   since it was last clean, so rewriting it does not put off the
+   write-back forever. */
 static void
-cache_evict(struct cache_entry* victim) 
+cache_set_dirty(struct cache_entry* entry)
 {
-  ASSERT (victim != NULL);
   ASSERT (lock_held_by_current_thread(&cache_lock));
+  ASSERT (entry->valid && !entry->io);
 
-  if (!victim->valid)
+  if (entry->dirty)
     return;
+  entry->dirty = true;
+  entry->dirty_tick = timer_ticks();
+  list_insert_ordered(&cache_dirty, &entry->dirty_elem, cache_dirty_less,
+      NULL);
+}
 
-  if (victim->dirty)
-    block_write(fs_device, victim->sector, victim->data);
-  victim->valid = false;
-  victim->dirty = false;
-  victim->accessed = false;
-  victim->sector = BLOCK_SECTOR_ERROR;
+/* Returns true if dirty ENTRY can be written back right now: no one
+   has it pinned, so no one is in the middle of changing it. */
+static bool
+cache_writable(const struct cache_entry* entry)
+{
+  ASSERT (entry->dirty);
+  return !entry->io && entry->pin_cnt == 0;
 }
 
-struct read_ahead_elem
-  {
-    struct list_elem elem;
-    block_sector_t sector; 
-    // The sector to read ahead, or BLOCK_SECTOR_ERROR to terminate the daemon
-  };
+/* Writes dirty, writable FIRST back to disk together with the
+   writable dirty entries for the sectors right before and after it,
+   up to CACHE_WRITE_RUN sectors in all, as one multi-sector device
+   request.  Returns the sector just past the run.
+   Called and returns with cache_lock held, but drops it around the
+   disk write.  The entries stay indexed under their sectors and are
+   marked IO meanwhile, so readers wait for the write instead of
+   fetching stale data from disk. */
+static block_sector_t
+cache_write_run(struct cache_entry* first)
+{
+  struct cache_entry* run[CACHE_WRITE_RUN];
+  const void* buffers[CACHE_WRITE_RUN];
+  struct list_elem* e;
+  size_t cnt = 0;
 
-void
-cache_read_ahead(block_sector_t sector) 
+  ASSERT (lock_held_by_current_thread(&cache_lock));
+  ASSERT (cache_writable(first));
+
+  /* Back up to the start of the run... */
+  e = &first->dirty_elem;
+  while (cnt < CACHE_WRITE_RUN / 2 && e != list_begin(&cache_dirty))
+    {
+      struct cache_entry* prev
+        = list_entry(list_prev(e), struct cache_entry, dirty_elem);
+      struct cache_entry* cur = list_entry(e, struct cache_entry, dirty_elem);
+      if (prev->sector + 1 != cur->sector || !cache_writable(prev))
+        break;
+      e = list_prev(e);
+      cnt++;
+    }
+
+  /* ...then collect it going forward. */
+  cnt = 0;
+  while (cnt < CACHE_WRITE_RUN && e != list_end(&cache_dirty))
+    {
+      struct cache_entry* entry = list_entry(e, struct cache_entry, dirty_elem);
+      if (cnt > 0 && (run[cnt - 1]->sector + 1 != entry->sector
+                      || !cache_writable(entry)))
+        break;
+      e = list_remove(e);
+      entry->dirty = false;
+      entry->io = true;
+      run[cnt] = entry;
+      buffers[cnt] = entry->data;
+      cnt++;
+    }
+  lock_release(&cache_lock);
+
+  /* No locks on the entries are needed: none was pinned, and anyone
+     who finds one now waits for IO to clear before touching it. */
+  block_write_multiple(fs_device, run[0]->sector, cnt, buffers);
+
+  lock_acquire(&cache_lock);
+  for (size_t i = 0; i < cnt; ++i)
+    {
+      run[i]->io = false;
+      cond_broadcast(&run[i]->io_done, &cache_lock);
+    }
+  cond_broadcast(&cache_idle, &cache_lock);
+  return run[0]->sector + cnt;
+}
+
+/* Reuses clean, unpinned ENTRY for SECTOR and, if FILL, reads it
+   in.  Called and returns with cache_lock held, but drops it around
+   the disk read.  ENTRY is indexed under SECTOR and marked IO
+   meanwhile. */
+static void
+cache_load(struct cache_entry* entry, block_sector_t sector, bool fill)
 {
-  struct read_ahead_elem* elem = malloc(sizeof(struct read_ahead_elem));
-  if (elem == NULL) return;
+  ASSERT (lock_held_by_current_thread(&cache_lock));
+  ASSERT (!entry->dirty && !entry->io && entry->pin_cnt == 0);
 
-  elem->sector = sector;
+  if (entry->valid)
+    hash_delete(&cache_index, &entry->elem);
+  if (entry->prefetched)
+    {
+      entry->prefetched = false;
+      cache_prefetched--;
+    }
+  entry->sector = sector;
+  entry->valid = false;
+  entry->uses = 0;
+  hash_insert(&cache_index, &entry->elem);
+  if (fill)
+    {
+      entry->io = true;
+      lock_release(&cache_lock);
+
+      block_read(fs_device, sector, entry->data);
+
+      lock_acquire(&cache_lock);
+    }
+  entry->valid = true;
+  entry->io = false;
+  cond_broadcast(&entry->io_done, &cache_lock);
+  cond_broadcast(&cache_idle, &cache_lock);
+}
+
+/* Gives the last page of sector data back to the user pool, for
+   frame_alloc() to use instead of evicting a process page.  Writes
+   back the page's dirty sectors first.  Returns false, without
+   waiting, if the cache is already at CACHE_MIN_SIZE or one of the
+   page's entries is pinned or busy. */
+bool
+cache_shrink(void)
+{
+  bool success = false;
+
+  lock_acquire(&cache_lock);
+  while (cache_cnt > CACHE_MIN_SIZE)
+    {
+      size_t first = cache_cnt - SECTORS_PER_PAGE;
+      struct cache_entry* dirty = NULL;
+      bool busy = false;
+      for (size_t i = first; i < cache_cnt; ++i)
+        {
+          if (cache[i].io || cache[i].pin_cnt > 0)
+            busy = true;
+          else if (cache[i].dirty)
+            dirty = &cache[i];
+        }
+      if (busy)
+        break;
+      if (dirty != NULL)
+        {
+          /* Drops cache_lock, so check the page over again. */
+          cache_write_run(dirty);
+          continue;
+        }
+
+      for (size_t i = first; i < cache_cnt; ++i)
+        if (cache[i].valid)
+          {
+            hash_delete(&cache_index, &cache[i].elem);
+            if (cache[i].prefetched)
+              {
+                cache[i].prefetched = false;
+                cache_prefetched--;
+              }
+            cache[i].sector = BLOCK_SECTOR_ERROR;
+            cache[i].valid = false;
+          }
+      cache_cnt = first;
+      if (cache_hand >= cache_cnt)
+        cache_hand = 0;
+      palloc_free_page(cache_pages[first / SECTORS_PER_PAGE]);
+      success = true;
+      break;
+    }
+  lock_release(&cache_lock);
+  return success;
+}
+
+/* Brings SECTOR into the cache for a reader expected to want it
+   soon, without pinning it.  Does nothing if the sector is already
+   cached or in flight, or if unused read-ahead data already fills
+   its share of the cache, so that prefetching can never push out
+   more than 1/CACHE_READ_AHEAD_SHARE of the cache's useful data. */
+static void
+cache_prefetch(block_sector_t sector)
+{
+  lock_acquire(&cache_lock);
+  while (cache_lookup(sector) == NULL
+         && cache_prefetched < cache_cnt / CACHE_READ_AHEAD_SHARE)
+    {
+      struct cache_entry* victim = cache_find_victim();
+      if (victim == NULL)
+        break;
+      if (victim->dirty)
+        {
+          cache_write_run(victim);
+          continue;
+        }
+      cache_load(victim, sector, true);
+      victim->prefetched = true;
+      cache_prefetched++;
+      break;
+    }
+  lock_release(&cache_lock);
+}
+
+/* Queues the CNT SECTORS for the read-ahead daemon, in order.
+   Sectors that do not fit in the queue are dropped: read-ahead is
+   only a hint. */
+void
+cache_read_ahead(const block_sector_t *sectors, size_t cnt) 
+{
+  if (cnt == 0)
+    return;
 
   lock_acquire(&read_ahead_lock);
-  list_push_back(&read_ahead_list, &elem->elem);
+  for (size_t i = 0; i < cnt && read_ahead_cnt < CACHE_READ_AHEAD_QUEUE; ++i)
+    {
+      size_t tail = (read_ahead_head + read_ahead_cnt) % CACHE_READ_AHEAD_QUEUE;
+      read_ahead_queue[tail] = sectors[i];
+      read_ahead_cnt++;
+    }
   cond_signal(&read_ahead_cond, &read_ahead_lock);
-
   lock_release(&read_ahead_lock);
 }
 
 static void
 cache_read_ahead_daemon(void *aux UNUSED) 
 {
+  static block_sector_t batch[CACHE_READ_AHEAD_QUEUE];
+
   lock_acquire(&read_ahead_lock);
   while (true) 
     {
-      while (list_empty(&read_ahead_list))
+      while (read_ahead_cnt == 0)
         cond_wait(&read_ahead_cond, &read_ahead_lock);
-      struct read_ahead_elem* elem = list_entry(list_pop_front(&read_ahead_list), struct read_ahead_elem, elem);
-      block_sector_t sector = elem->sector;
-      free(elem);
-      if (sector == BLOCK_SECTOR_ERROR)
-        break;
-      cache_pull(sector);           
-    }
 
-  lock_release(&read_ahead_lock);
-}
+      /* Take the whole queue as one batch. */
+      size_t cnt = read_ahead_cnt;
+      for (size_t i = 0; i < cnt; ++i)
+        batch[i] = read_ahead_queue[(read_ahead_head + i) % CACHE_READ_AHEAD_QUEUE];
+      read_ahead_head = (read_ahead_head + cnt) % CACHE_READ_AHEAD_QUEUE;
+      read_ahead_cnt = 0;
+      lock_release(&read_ahead_lock);
 
-struct write_behind_elem
-  {
-    struct list_elem elem;
-    bool terminate;    
-  };
+      for (size_t i = 0; i < cnt; ++i)
+        cache_prefetch(batch[i]);
 
+      lock_acquire(&read_ahead_lock);
+    }
+}
+
+/* Asks the write-behind daemon to exit if TERMINATE, otherwise to
+   write back every dirty sector, old or not, on its next pass. */
 void
 cache_write_behind(bool terminate) 
 {
-  struct write_behind_elem* elem = malloc(sizeof(struct write_behind_elem));
-  if (elem == NULL) return;
-
-  elem->terminate = terminate;
-
-  lock_acquire(&write_behind_lock);
-  list_push_back(&write_behind_list, &elem->elem);
-  lock_release(&write_behind_lock);
+  lock_acquire(&cache_lock);
+  if (terminate)
+    write_behind_stop = true;
+  else
+    write_behind_all = true;
+  lock_release(&cache_lock);
 }
 
+/* Every CACHE_FLUSH_INTERVAL ms, writes back the sectors that have
+   been dirty for CACHE_DIRTY_AGE ms or more, in ascending sector
+   order, each coalesced with its dirty neighbours.  Young sectors
+   are left alone unless they ride along with an old one, so that a
+   sector rewritten over and over is written once per period rather
+   than once per change.  cache_lock is only held between runs, so
+   readers are never stuck behind the whole pass. */
 static void
 cache_write_behind_daemon(void *aux UNUSED) 
 {
+  const int64_t max_age = (int64_t) CACHE_DIRTY_AGE * TIMER_FREQ / 1000;
+
   while (true)
     {
-      lock_acquire(&write_behind_lock);
-      if (!list_empty(&write_behind_list))
+      timer_msleep(CACHE_FLUSH_INTERVAL);
+
+      lock_acquire(&cache_lock);
+      if (write_behind_stop)
+        break;
+      bool all = write_behind_all;
+      write_behind_all = false;
+
+      int64_t now = timer_ticks();
+      block_sector_t next = 0;
+      while (true)
         {
-          struct write_behind_elem* elem = list_entry(list_pop_front(&write_behind_list), struct write_behind_elem, elem);
-          bool terminate = elem->terminate;
-          free(elem);
-          if (terminate)
+          /* The list changes while cache_lock is dropped, so find
+             the first old sector past the last run each time. */
+          struct cache_entry* first = NULL;
+          for (struct list_elem* e = list_begin(&cache_dirty);
+               e != list_end(&cache_dirty); e = list_next(e))
+            {
+              struct cache_entry* entry
+                = list_entry(e, struct cache_entry, dirty_elem);
+              if (entry->sector >= next && cache_writable(entry)
+                  && (all || now - entry->dirty_tick >= max_age))
+                {
+                  first = entry;
+                  break;
+                }
+            }
+          if (first == NULL)
             break;
+          next = cache_write_run(first);
         }
-      lock_release(&write_behind_lock);
-
-      cache_flush();
-      thread_sleep(CACHE_FLUSH_INTERVAL);
+      lock_release(&cache_lock);
     }
   
-  lock_release(&write_behind_lock);
+  lock_release(&cache_lock);
 }
@@ -1,6 +1,8 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <hash.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include "devices/block.h"
@@ -8,25 +10,51 @@
 
 #define BLOCK_SECTOR_ERROR 0xffffffff
 
-#define CACHE_SIZE 64
-#define CACHE_FLUSH_INTERVAL 10000
+#define CACHE_SIZE 64           /* Default number of cached sectors. */
+#define CACHE_MIN_SIZE 16       /* Floor for -cache=N and for shrinking. */
+#define CACHE_POOL_DIV 4        /* Cache takes <= 1/DIV of the user pool. */
+#define CACHE_FLUSH_INTERVAL 500 /* Ms between write-behind passes. */
+#define CACHE_DIRTY_AGE 2000    /* Ms a sector may stay dirty in memory. */
+#define CACHE_WRITE_RUN 16      /* Max sectors coalesced into one write. */
+#define CACHE_MAX_USES 3        /* Cap on an entry's second chances. */
+#define CACHE_READ_AHEAD_QUEUE 32 /* Pending read-ahead sectors. */
+#define CACHE_READ_AHEAD_SHARE 4 /* Unread prefetches fill <= 1/SHARE. */
 
 struct cache_entry 
   {
     block_sector_t sector;
     bool dirty;
+    int64_t dirty_tick;         /* Timer tick at which it became dirty. */
     bool valid;
-    bool accessed;
-    uint8_t data[BLOCK_SECTOR_SIZE];
-    struct lock lock;
+    unsigned uses;              /* Clock second chances, 0..CACHE_MAX_USES. */
+    int pin_cnt;                /* Users that must not see it evicted. */
+    bool io;                    /* Disk I/O in progress, data not usable. */
+    bool prefetched;            /* Read ahead and not yet used. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes in a cache page. */
+    struct lock lock;           /* Held while copying DATA. */
+    struct condition io_done;   /* Signaled on cache_lock when IO clears. */
+    struct hash_elem elem;      /* Element in the sector index. */
+    struct list_elem dirty_elem; /* Element in the dirty list, if dirty. */
   };
 
-void cache_init(void);
+/* How cache_get() callers intend to use a sector. */
+enum cache_mode
+  {
+    CACHE_READ,                 /* Only read DATA. */
+    CACHE_WRITE,                /* Modify part of DATA. */
+    CACHE_OVERWRITE             /* Replace all of DATA; skips the disk read. */
+  };
+
+void cache_init(size_t size);
+bool cache_shrink(void);
+struct cache_entry* cache_get(block_sector_t sector, enum cache_mode mode);
+void cache_mark_dirty(struct cache_entry* entry);
+void cache_put(struct cache_entry* entry);
 void cache_read(block_sector_t sector, void *buffer);
 void cache_write(block_sector_t sector, const void *buffer);
 void cache_flush(void);
 
-void cache_read_ahead(block_sector_t sector);
+void cache_read_ahead(const block_sector_t *sectors, size_t cnt);
 void cache_write_behind(bool terminate);
 
 
@@ -0,0 +1,183 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory name cache.  Maps a name in a directory, identified by
+   the directory's inode sector, to the inode sector the name refers
+   to, or to NOT_A_SECTOR if the directory is known to have no such
+   name.  Path resolution consults it before reading directory
+   contents.  The directory code keeps it coherent: dir_add() and
+   dir_remove() update the names they touch, and removing a
+   directory drops everything cached under it, since its sector may
+   be reused for another directory. */
+struct dcache_entry
+  {
+    struct hash_elem elem;              /* Element in DCACHE. */
+    struct list_elem lru_elem;          /* Element in DCACHE_LRU. */
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated name. */
+    block_sector_t sector;              /* Inode sector, or NOT_A_SECTOR. */
+  };
+
+static struct hash dcache;
+static struct list dcache_lru;          /* Most recently used first. */
+static size_t dcache_cnt;
+static struct lock dcache_lock;
+
+static struct dcache_entry *dcache_find (block_sector_t parent,
+                                         const char *name);
+static void dcache_drop (struct dcache_entry *);
+
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *entry = hash_entry (e, struct dcache_entry, elem);
+  return hash_string (entry->name) ^ hash_int ((int) entry->parent);
+}
+
+static bool
+dcache_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *entry_a = hash_entry (a, struct dcache_entry, elem);
+  const struct dcache_entry *entry_b = hash_entry (b, struct dcache_entry, elem);
+  if (entry_a->parent != entry_b->parent)
+    return entry_a->parent < entry_b->parent;
+  return strcmp (entry_a->name, entry_b->name) < 0;
+}
+
+/* Initializes the directory name cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dcache, dcache_hash, dcache_less, NULL);
+  list_init (&dcache_lru);
+  dcache_cnt = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector PARENT.
+   Returns false if the cache knows nothing about it.  Otherwise
+   returns true and sets *SECTOR to the inode sector NAME refers to,
+   or to NOT_A_SECTOR if it is known not to exist. */
+bool
+dcache_lookup (block_sector_t parent, const char *name,
+               block_sector_t *sector)
+{
+  struct dcache_entry *entry;
+
+  lock_acquire (&dcache_lock);
+  entry = dcache_find (parent, name);
+  if (entry != NULL)
+    {
+      list_remove (&entry->lru_elem);
+      list_push_front (&dcache_lru, &entry->lru_elem);
+      *sector = entry->sector;
+    }
+  lock_release (&dcache_lock);
+  return entry != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   PARENT refers to the inode in SECTOR, or does not exist if SECTOR
+   is NOT_A_SECTOR.  Evicts the least recently used name if the
+   cache is full.  Names too long to be in a directory are not
+   cached. */
+void
+dcache_insert (block_sector_t parent, const char *name,
+               block_sector_t sector)
+{
+  struct dcache_entry *entry;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  entry = dcache_find (parent, name);
+  if (entry != NULL)
+    list_remove (&entry->lru_elem);
+  else
+    {
+      if (dcache_cnt >= DCACHE_SIZE)
+        dcache_drop (list_entry (list_back (&dcache_lru),
+                                 struct dcache_entry, lru_elem));
+      entry = malloc (sizeof *entry);
+      if (entry == NULL)
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      entry->parent = parent;
+      strlcpy (entry->name, name, sizeof entry->name);
+      hash_insert (&dcache, &entry->elem);
+      dcache_cnt++;
+    }
+  entry->sector = sector;
+  list_push_front (&dcache_lru, &entry->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets NAME in the directory whose inode is in sector PARENT. */
+void
+dcache_invalidate (block_sector_t parent, const char *name)
+{
+  struct dcache_entry *entry;
+
+  lock_acquire (&dcache_lock);
+  entry = dcache_find (parent, name);
+  if (entry != NULL)
+    dcache_drop (entry);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory whose inode is in sector
+   PARENT. */
+void
+dcache_invalidate_dir (block_sector_t parent)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); )
+    {
+      struct dcache_entry *entry = list_entry (e, struct dcache_entry,
+                                               lru_elem);
+      e = list_next (e);
+      if (entry->parent == parent)
+        dcache_drop (entry);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer. */
+static struct dcache_entry *
+dcache_find (block_sector_t parent, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, elem) : NULL;
+}
+
+/* Removes ENTRY from the cache and frees it. */
+static void
+dcache_drop (struct dcache_entry *entry)
+{
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+  hash_delete (&dcache, &entry->elem);
+  list_remove (&entry->lru_elem);
+  dcache_cnt--;
+  free (entry);
+}
@@ -0,0 +1,17 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+#define DCACHE_SIZE 128         /* Most names cached at once. */
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t parent, const char *name,
+                    block_sector_t *sector);
+void dcache_insert (block_sector_t parent, const char *name,
+                    block_sector_t sector);
+void dcache_invalidate (block_sector_t parent, const char *name);
+void dcache_invalidate_dir (block_sector_t parent);
+
+#endif /* filesys/dcache.h */
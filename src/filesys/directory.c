@@ -2,7 +2,10 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "stdbool.h"
@@ -23,6 +26,45 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A directory starts out as a plain array of entries, scanned in
+   full by every lookup.  Once it has DIR_HASH_THRESHOLD slots and
+   needs another, it is rewritten as a hash table of buckets, one
+   per sector: a name's entry is in bucket hash_string(name) modulo
+   the number of buckets, or in one of the overflow buckets chained
+   after it, so a lookup reads one sector in the common case.
+   Buckets never used are holes in the file and take no disk
+   space. */
+#define DIR_HASH_THRESHOLD 64           /* Slots before switching to hashing. */
+#define DIR_HASH_BUCKETS 64             /* Initial buckets of a hashed directory. */
+#define DIR_BUCKET_ENTRIES 25           /* Entries per bucket. */
+
+/* A bucket of a hashed directory.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint32_t next;                      /* Overflow bucket, or 0 if none. */
+    uint32_t unused[2];                 /* Not used. */
+  };
+
+static bool dir_hash (struct dir *);
+static bool is_empty (struct dir *);
+static bool add_linear (struct dir *, const struct dir_entry *);
+static bool add_hashed (struct dir *, const struct dir_entry *);
+
+/* Returns the offset of the entry slot following the one at OFS
+   in DIR, skipping the tail of each bucket in a hashed directory. */
+static off_t
+next_slot (const struct dir *dir, off_t ofs)
+{
+  ofs += sizeof (struct dir_entry);
+  if (inode_dir_buckets (dir->inode) != 0
+      && ofs % BLOCK_SECTOR_SIZE
+         == DIR_BUCKET_ENTRIES * sizeof (struct dir_entry))
+    ofs = ROUND_UP (ofs, BLOCK_SECTOR_SIZE);
+  return ofs;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -118,10 +160,41 @@ lookup (const struct dir *dir, const char *name,
 {
   struct dir_entry e;
   size_t ofs;
+  uint32_t buckets;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  buckets = inode_dir_buckets (dir->inode);
+  if (buckets != 0)
+    {
+      /* Hashed: only NAME's bucket chain can hold it. */
+      struct dir_bucket *b = malloc (sizeof *b);
+      bool found = false;
+      if (b == NULL)
+        return false;
+      ofs = hash_string (name) % buckets * sizeof *b;
+      while (!found
+             && inode_read_at (dir->inode, b, sizeof *b, ofs) == sizeof *b)
+        {
+          for (size_t i = 0; i < DIR_BUCKET_ENTRIES; i++)
+            if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+              {
+                if (ep != NULL)
+                  *ep = b->entries[i];
+                if (ofsp != NULL)
+                  *ofsp = ofs + i * sizeof e;
+                found = true;
+                break;
+              }
+          if (b->next == 0)
+            break;
+          ofs = b->next * sizeof *b;
+        }
+      free (b);
+      return found;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -138,21 +211,35 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Answers from the directory name cache when it can, and adds the
+   outcome of a search to it, whether found or not. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  block_sector_t parent, sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL)){    
-    *inode = inode_open (e.inode_sector);
-  }
-  else
-    *inode = NULL;
+  /* The directory lock, even shared, keeps a concurrent dir_add() or
+     dir_remove() from changing the outcome before it is cached, and
+     keeps the file from being removed, and its sector freed and
+     reused, before it is opened. */
+  parent = inode_get_inumber (dir->inode);
+  inode_lock_dir (dir->inode, false);
+  if (!dcache_lookup (parent, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : NOT_A_SECTOR;
+      /* A removed directory's sector may be reused for another, which
+         must not inherit what was cached under it. */
+      if (!inode_is_removed (dir->inode))
+        dcache_insert (parent, name, sector);
+    }
+  *inode = sector != NOT_A_SECTOR ? inode_open (sector) : NULL;
+  inode_unlock_dir (dir->inode, false);
 
   return *inode != NULL;
 }
@@ -167,7 +254,6 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
-  off_t ofs;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -177,10 +263,35 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that DIR was not removed and NAME is not in use. */
+  inode_lock_dir (dir->inode, true);
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL))
     goto done;
 
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (inode_dir_buckets (dir->inode) != 0)
+    success = add_hashed (dir, &e);
+  else
+    success = add_linear (dir, &e);
+
+ done:
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+  inode_unlock_dir (dir->inode, true);
+  return success;
+}
+
+/* Adds entry E to linear directory DIR, in the first free slot or
+   at the end, unless DIR is full and large enough to be hashed
+   instead.  Returns true if successful, false on failure. */
+static bool
+add_linear (struct dir *dir, const struct dir_entry *e)
+{
+  struct dir_entry slot;
+  off_t ofs;
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -188,18 +299,149 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
+  for (ofs = 0;
+       inode_read_at (dir->inode, &slot, sizeof slot, ofs) == sizeof slot;
+       ofs += sizeof slot) 
+    if (!slot.in_use)
       break;
 
+  /* A full directory that is already large enough becomes hashed
+     instead of growing further. */
+  if (ofs >= inode_length (dir->inode)
+      && ofs >= (off_t) (DIR_HASH_THRESHOLD * sizeof *e) && dir_hash (dir))
+    return add_hashed (dir, e);
+
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  return inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+}
+
+/* Adds entry E to hashed directory DIR, in the first free slot of
+   its bucket chain, appending an overflow bucket if they are all
+   full.  Returns true if successful, false on failure. */
+static bool
+add_hashed (struct dir *dir, const struct dir_entry *e)
+{
+  struct dir_bucket *b = malloc (sizeof *b);
+  off_t ofs;
+  bool success = false;
+
+  if (b == NULL)
+    return false;
+  ofs = hash_string (e->name) % inode_dir_buckets (dir->inode) * sizeof *b;
+  while (inode_read_at (dir->inode, b, sizeof *b, ofs) == sizeof *b)
+    {
+      for (size_t i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (!b->entries[i].in_use)
+          {
+            off_t slot = ofs + i * sizeof *e;
+            success = inode_write_at (dir->inode, e, sizeof *e, slot)
+                      == sizeof *e;
+            goto done;
+          }
+      if (b->next == 0)
+        {
+          /* Chain a new bucket at the end of the file. */
+          uint32_t next = inode_length (dir->inode) / sizeof *b;
+          memset (b, 0, sizeof *b);
+          b->entries[0] = *e;
+          success = inode_write_at (dir->inode, b, sizeof *b,
+                                    next * sizeof *b) == sizeof *b
+                    && inode_write_at (dir->inode, &next, sizeof next,
+                                       ofs + offsetof (struct dir_bucket, next))
+                       == sizeof next;
+          goto done;
+        }
+      ofs = b->next * sizeof *b;
+    }
 
  done:
+  free (b);
+  return success;
+}
+
+/* Converts linear directory DIR into a hashed one with enough
+   buckets to cover its current length, rehashing its entries.
+   The hashed layout is built in memory and written out before DIR
+   is marked hashed.  Returns true if successful, false on failure,
+   in which case DIR is left linear with all its entries, unless
+   even writing them back fails. */
+static bool
+dir_hash (struct dir *dir)
+{
+  off_t length = inode_length (dir->inode);
+  uint32_t buckets = DIV_ROUND_UP (length, sizeof (struct dir_bucket));
+  struct dir_entry *entries;
+  struct dir_bucket *table;
+  size_t cnt = length / sizeof *entries;
+  uint32_t used;
+  off_t written = 0;
+  bool success = true;
+
+  if (buckets < DIR_HASH_BUCKETS)
+    buckets = DIR_HASH_BUCKETS;
+  entries = malloc (length);
+  table = calloc (buckets + DIV_ROUND_UP (cnt, DIR_BUCKET_ENTRIES),
+                  sizeof *table);
+  if (entries == NULL || table == NULL
+      || inode_read_at (dir->inode, entries, length, 0) != length)
+    {
+      free (entries);
+      free (table);
+      return false;
+    }
+
+  /* Lay out the buckets, appending overflow buckets after the last
+     one as add_hashed() would. */
+  used = buckets;
+  for (size_t i = 0; i < cnt; i++)
+    if (entries[i].in_use)
+      {
+        struct dir_bucket *b = &table[hash_string (entries[i].name) % buckets];
+        size_t slot;
+
+        for (;;)
+          {
+            for (slot = 0; slot < DIR_BUCKET_ENTRIES; slot++)
+              if (!b->entries[slot].in_use)
+                break;
+            if (slot < DIR_BUCKET_ENTRIES)
+              break;
+            if (b->next == 0)
+              b->next = used++;
+            b = &table[b->next];
+          }
+        b->entries[slot] = entries[i];
+      }
+
+  /* Write every bucket that is in use or overlaps the old entries,
+     and the last one, which sets the length; the buckets in between
+     read as zeros, that is, empty. */
+  for (uint32_t i = 0; success && i < used; i++)
+    {
+      off_t ofs = i * sizeof *table;
+      if (ofs < length || i == used - 1 || table[i].entries[0].in_use
+          || table[i].next != 0)
+        {
+          success = inode_write_at (dir->inode, &table[i], sizeof *table, ofs)
+                    == sizeof *table;
+          if (ofs + (off_t) sizeof *table > written)
+            written = ofs + sizeof *table;
+        }
+    }
+
+  if (success)
+    inode_set_dir_buckets (dir->inode, buckets);
+  else
+    {
+      /* Put the entries back, and empty whatever was written past
+         them, so that the linear directory reads as before. */
+      memset (table, 0, sizeof *table);
+      inode_write_at (dir->inode, entries, length, 0);
+      for (off_t ofs = length; ofs < written; ofs += sizeof *table)
+        inode_write_at (dir->inode, table, sizeof *table, ofs);
+    }
+  free (entries);
+  free (table);
   return success;
 }
 
@@ -217,7 +459,12 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* "." and ".." go with the directory itself. */
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
   /* Find directory entry. */
+  inode_lock_dir (dir->inode, true);
   if (!lookup (dir, name, &e, &ofs)){
     goto done;
   }
@@ -227,17 +474,26 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL){
     goto done;
   }
-  /* If the inode represents a dir*/
+  /* If the inode represents a dir, it must be empty, and stay so:
+     its lock is held until it is marked removed, which dir_add()
+     checks.  Parent before child is the locking order. */
   if(inode_is_dir(inode)){
-    struct dir * dir_local = dir_open(inode);
-    if(!dir_is_empty(dir_local)){
-      dir_close(dir_local);
-      return false;
+    struct dir dir_local = { inode, 0 };
+    inode_lock_dir (inode, true);
+    if(!is_empty(&dir_local)){
+      inode_unlock_dir (inode, true);
+      inode_close (inode);
+      goto done;
     }
-    free(dir_local);
   }
-  /* Remove inode. */
+  /* Remove inode, and anything cached under it if a directory,
+     since its sector may be reused. */
+  if (inode_is_dir (inode))
+    dcache_invalidate_dir (e.inode_sector);
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
   inode_remove (inode);
+  if (inode_is_dir (inode))
+    inode_unlock_dir (inode, true);
   inode_close (inode);
 
   /* Erase directory entry. */
@@ -248,6 +504,7 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode, true);
   return success;
 }
 
@@ -258,27 +515,42 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  inode_lock_dir (dir->inode, false);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
-      dir->pos += sizeof e;
+      dir->pos = next_slot (dir, dir->pos);
       if (e.in_use)
         {
           // do not return . and ..
           if(strcmp(e.name,".") == 0 || strcmp(e.name,"..") == 0)
             continue;
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  inode_unlock_dir (dir->inode, false);
+  return found;
 }
 
 bool dir_is_empty(struct dir * dir){
+  inode_lock_dir (dir->inode, false);
+  bool empty = is_empty (dir);
+  inode_unlock_dir (dir->inode, false);
+  return empty;
+}
+
+/* Returns true if DIR has no entries but "." and "..".
+   The caller must hold DIR's lock, shared or exclusive. */
+static bool
+is_empty (struct dir *dir)
+{
   struct dir_entry e;
   off_t ofs;
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e){
+       ofs = next_slot (dir, ofs)){
     if(e.in_use && strcmp(e.name,".") != 0 && strcmp(e.name,"..") != 0){
       return false;
     }
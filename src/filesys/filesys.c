@@ -9,6 +9,7 @@
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -31,6 +32,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
   if (format) 
     do_format ();
@@ -1,22 +1,72 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Protects the free map, the summary and the dirty bits.  Held
+   while changed sectors are written to the free map file, whose
+   inode lock therefore comes after it; the free map file never
+   grows, so writing it never allocates. */
+static struct lock free_map_lock;
+
+/* Sectors of the free map file that changed since they were last
+   written to it, one bit per sector.  Only these are written back,
+   into the buffer cache, whose write-behind takes them to disk. */
+static struct bitmap *free_map_dirty;
+
+/* Free map bits per sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Free space summary.  The free map is divided into groups of
+   FREE_GROUP_SIZE sectors, and FREE_TREE, a complete binary tree
+   stored as an array, keeps at each leaf the longest run of free
+   sectors in one group, and at each inner node the maximum of its
+   children.  Finding a group with a run of a given length at or
+   after a goal takes O(log groups) steps instead of a scan of the
+   whole bitmap. */
+#define FREE_GROUP_SIZE 1024
+static size_t free_groups;          /* Number of groups. */
+static size_t free_tree_leaves;     /* Leaves, a power of 2 >= FREE_GROUPS. */
+static uint16_t *free_tree;         /* Node N has children 2N and 2N+1. */
+
+static void free_map_set (block_sector_t, size_t, bool);
+static size_t free_map_find (block_sector_t goal, size_t cnt);
+static void free_map_summarize (size_t first_group, size_t last_group);
+static void free_map_changed (block_sector_t, size_t);
+static bool free_map_flush (void);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+
+  free_groups = DIV_ROUND_UP (bitmap_size (free_map), FREE_GROUP_SIZE);
+  for (free_tree_leaves = 1; free_tree_leaves < free_groups;
+       free_tree_leaves *= 2)
+    continue;
+  free_tree = calloc (2 * free_tree_leaves, sizeof *free_tree);
+  if (free_tree == NULL)
+    PANIC ("free space summary creation failed");
+  free_map_summarize (0, free_groups - 1);
+
+  free_map_set (FREE_MAP_SECTOR, 1, true);
+  free_map_set (ROOT_DIR_SECTOR, 1, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +77,238 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  lock_acquire (&free_map_lock);
+  size_t sector = free_map_find (0, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      free_map_set (sector, cnt, true);
+      if (!free_map_flush ())
+        {
+          free_map_set (sector, cnt, false); 
+          sector = BITMAP_ERROR;
+        }
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT consecutive sectors, as close after GOAL as
+   possible, and stores the first into *SECTORP.  In order of
+   preference, the run starts right at GOAL, so that it continues
+   whatever ends just before it, or is the first run of all CNT
+   sectors after GOAL (wrapping around), or is as much as is free
+   after the first free sector after GOAL.
+   Returns the number of sectors allocated, 0 if none is free or
+   the free_map file could not be written. */
+size_t
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector, n;
+
+  ASSERT (cnt > 0);
+  if (goal >= size)
+    goal = 0;
+
+  lock_acquire (&free_map_lock);
+  if (!bitmap_test (free_map, goal))
+    {
+      sector = goal;
+      n = 1;
+    }
+  else
+    {
+      sector = free_map_find (goal, cnt);
+      if (sector != BITMAP_ERROR)
+        n = cnt;
+      else
+        {
+          sector = free_map_find (goal, 1);
+          if (sector == BITMAP_ERROR)
+            {
+              lock_release (&free_map_lock);
+              return 0;
+            }
+          n = 1;
+        }
+    }
+  while (n < cnt && sector + n < size && !bitmap_test (free_map, sector + n))
+    n++;
+
+  free_map_set (sector, n, true);
+  if (!free_map_flush ())
+    {
+      free_map_set (sector, n, false);
+      n = 0;
+    }
+  lock_release (&free_map_lock);
+  if (n > 0)
+    *sectorp = sector;
+  return n;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_set (sector, cnt, false);
+  free_map_flush ();
+  lock_release (&free_map_lock);
+}
+
+/* Sets the CNT bits starting at SECTOR to VALUE, keeping the free
+   space summary up to date and noting the change for
+   free_map_flush(). */
+static void
+free_map_set (block_sector_t sector, size_t cnt, bool value)
+{
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  free_map_summarize (sector / FREE_GROUP_SIZE,
+                      (sector + cnt - 1) / FREE_GROUP_SIZE);
+  free_map_changed (sector, cnt);
+}
+
+/* Returns the first sector of the first run of CNT free sectors in
+   group GROUP that starts at or after sector FROM, or BITMAP_ERROR
+   if there is none. */
+static size_t
+free_group_scan (size_t group, size_t from, size_t cnt)
+{
+  size_t end = (group + 1) * FREE_GROUP_SIZE;
+  size_t run = 0;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  for (size_t i = from; i < end; i++)
+    {
+      run = bitmap_test (free_map, i) ? 0 : run + 1;
+      if (run == cnt)
+        return i + 1 - cnt;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Returns the first group at or after FROM that has a run of CNT
+   free sectors, or BITMAP_ERROR if there is none. */
+static size_t
+free_tree_find (size_t from, size_t cnt)
+{
+  size_t node;
+
+  if (from >= free_groups)
+    return BITMAP_ERROR;
+  node = free_tree_leaves + from;
+  if (free_tree[node] < cnt)
+    {
+      /* Climb until there is a subtree to the right with room... */
+      while (node > 1 && ((node & 1) != 0 || free_tree[node + 1] < cnt))
+        node /= 2;
+      if (node == 1)
+        return BITMAP_ERROR;
+      node++;
+
+      /* ...then descend to its leftmost leaf with room. */
+      while (node < free_tree_leaves)
+        node = free_tree[2 * node] >= cnt ? 2 * node : 2 * node + 1;
+    }
+  return node - free_tree_leaves;
+}
+
+/* Returns the first sector of a run of CNT free sectors, the first
+   at or after GOAL if there is one and otherwise the first from the
+   start of the disk, or BITMAP_ERROR if there is none.  Runs that
+   fit in a group are found through the free space summary; longer
+   ones, and runs that only exist across a group boundary, fall back
+   to a scan of the bitmap. */
+static size_t
+free_map_find (block_sector_t goal, size_t cnt)
+{
+  size_t group = goal / FREE_GROUP_SIZE;
+  size_t sector;
+
+  ASSERT (cnt > 0);
+  if (cnt <= FREE_GROUP_SIZE)
+    {
+      if (free_tree[free_tree_leaves + group] >= cnt)
+        {
+          sector = free_group_scan (group, goal, cnt);
+          if (sector != BITMAP_ERROR)
+            return sector;
+        }
+      group = free_tree_find (group + 1, cnt);
+      if (group == BITMAP_ERROR)
+        group = free_tree_find (0, cnt);
+      if (group != BITMAP_ERROR)
+        return free_group_scan (group, group * FREE_GROUP_SIZE, cnt);
+    }
+
+  sector = bitmap_scan (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+  return sector;
+}
+
+/* Recomputes the free space summary for groups FIRST...LAST. */
+static void
+free_map_summarize (size_t first, size_t last)
+{
+  for (size_t group = first; group <= last; group++)
+    {
+      size_t end = (group + 1) * FREE_GROUP_SIZE;
+      size_t run = 0, longest = 0;
+
+      if (end > bitmap_size (free_map))
+        end = bitmap_size (free_map);
+      for (size_t i = group * FREE_GROUP_SIZE; i < end; i++)
+        {
+          run = bitmap_test (free_map, i) ? 0 : run + 1;
+          if (run > longest)
+            longest = run;
+        }
+
+      size_t node = free_tree_leaves + group;
+      free_tree[node] = longest;
+      for (node /= 2; node >= 1; node /= 2)
+        free_tree[node] = free_tree[2 * node] > free_tree[2 * node + 1]
+                          ? free_tree[2 * node] : free_tree[2 * node + 1];
+    }
+}
+
+/* Notes that the free map bits for the CNT sectors starting at
+   SECTOR changed. */
+static void
+free_map_changed (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Writes the changed sectors of the free map to the free map file.
+   Returns true if successful; on failure, the sectors not written
+   stay marked as changed. */
+static bool
+free_map_flush (void)
+{
+  size_t idx = 0;
+
+  if (free_map_file == NULL)
+    return true;
+  while ((idx = bitmap_scan (free_map_dirty, idx, 1, true)) != BITMAP_ERROR)
+    {
+      if (!bitmap_write_part (free_map, free_map_file,
+                              idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        return false;
+      bitmap_reset (free_map_dirty, idx);
+    }
+  return true;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +320,8 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+  free_map_summarize (0, free_groups - 1);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -82,4 +346,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
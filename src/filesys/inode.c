@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -10,78 +11,76 @@
 #include "filesys/cache.h"
 #include "stdbool.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
-#define INDIRECT_BLOCK_MAGIC 0x494e4449
-#define DOUBLE_INDIRECT_BLOCK_MAGIC 0x44424944
-#define DIRECT_BLOCK_SIZE 12
-#define INDIRECT_BLOCK_SIZE 127
-#define DOUBLE_INDIRECT_BLOCK_SIZE 127
-#define DOUBLE_INDIRECT_BLOCK_IN_INODE_SIZE 2
+#define EXTENT_BLOCK_MAGIC 0x45585442
+#define INODE_EXTENT_CNT 41             /* Extents held in the inode itself. */
+#define INODE_INDEX_CNT 62              /* Extent blocks an inode can index. */
+#define EXTENT_BLOCK_CNT 42             /* Extents per extent block. */
+#define READ_AHEAD_MIN 2                /* Window after the first sequential read. */
+#define READ_AHEAD_MAX 16               /* Largest read-ahead window, in sectors. */
+#define XLAT_CNT 4                      /* Recently used extents kept per inode. */
+#define PREALLOC_SECTORS 8              /* Reserved past EOF on extending writes. */
 
 static char zeros[BLOCK_SECTOR_SIZE];
 
-/* On-disk indirect block.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
-struct indirect_block_disk_t
-{
-  block_sector_t direct_blocks[128 - 1];
-  unsigned magic;                     /* Magic number. */
-};
+/* A run of CNT sectors of a file, starting at sector LOGICAL of
+   the file and at sector PHYSICAL of the disk.  Sectors of the file
+   not covered by any extent are holes and read as zeros. */
+struct extent
+  {
+    block_sector_t logical;             /* First sector within the file. */
+    block_sector_t physical;            /* First sector on disk. */
+    block_sector_t cnt;                 /* Number of sectors. */
+  };
 
-/* On-disk double indirect block.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
-struct double_indirect_block_disk_t
-{
-  block_sector_t indirect_block_disk[128 - 1];
-  unsigned magic;                     /* Magic number. */
-};
+/* Entry in an inode's index of extent blocks. */
+struct extent_index
+  {
+    block_sector_t logical;             /* Lowest sector the block maps. */
+    block_sector_t block;               /* Sector of the extent block. */
+  };
 
+/* On-disk extent block, a leaf of the extent tree holding extents
+   sorted by LOGICAL.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    uint32_t cnt;                       /* Number of extents in use. */
+    unsigned magic;                     /* Magic number. */
+    struct extent extents[EXTENT_BLOCK_CNT];
+  };
 
-/* On-disk inode.
+/* On-disk inode.  Maps the file's data with extents sorted by
+   LOGICAL: at depth 0 up to INODE_EXTENT_CNT of them are kept right
+   here, and at depth 1 the inode instead indexes up to
+   INODE_INDEX_CNT extent blocks, sorted by the lowest sector each
+   one maps, the first always from sector 0.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
     off_t length;                       /* File size in bytes. */
-    block_sector_t direct_blocks[12];  /* Direct blocks. */
-    block_sector_t indirect_block;      /* Indirect block. */
-    block_sector_t double_indirect_block[2]; /* Double indirect block. */
-    bool isdir;                         /* Is a directory or not. default: not. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[110];               /* Not used. */
+    bool isdir;                         /* Is a directory or not. default: not. */
+    uint8_t depth;                      /* 0: extents inline, 1: indexed. */
+    uint16_t cnt;                       /* Slots in use in EXTENTS or INDEX. */
+    union
+      {
+        struct extent extents[INODE_EXTENT_CNT];   /* Depth 0. */
+        struct extent_index index[INODE_INDEX_CNT]; /* Depth 1. */
+      };
+    uint32_t dir_buckets;               /* Hashed directory's buckets, or 0. */
   };
 
-static struct double_indirect_block_disk_t template_disk_double_indirect_block;
-static struct indirect_block_disk_t template_disk_indirect_block;
-static struct inode_disk template_disk_inode;
-
-void template_init(void);
-bool direct_block_init_if_need(block_sector_t *sector);
-bool indirect_block_init_if_need(block_sector_t *sector);
-bool double_indirect_block_init_if_need(block_sector_t *sector);
-block_sector_t inode_seek (struct inode_disk * inode_disk, block_sector_t logical_sector);
-
-void template_init(){
-  /* init template_disk_double_indirect_block */
-  for(int i = 0;i<DOUBLE_INDIRECT_BLOCK_SIZE;++i)
-    template_disk_double_indirect_block.indirect_block_disk[i] = NOT_A_SECTOR;
-  template_disk_double_indirect_block.magic = DOUBLE_INDIRECT_BLOCK_MAGIC;
-  /* init template_disk_indirect_block */
-  for(int i = 0;i<INDIRECT_BLOCK_SIZE;++i)
-    template_disk_indirect_block.direct_blocks[i] = NOT_A_SECTOR;
-  template_disk_indirect_block.magic = INDIRECT_BLOCK_MAGIC;
-  /* init template_disk_inode */
-  for(int i = 0;i<DOUBLE_INDIRECT_BLOCK_IN_INODE_SIZE;++i)
-    template_disk_inode.double_indirect_block[i] = NOT_A_SECTOR;
-  for(int i = 0;i<DIRECT_BLOCK_SIZE;++i)
-    template_disk_inode.direct_blocks[i] = NOT_A_SECTOR;
-  template_disk_inode.indirect_block = NOT_A_SECTOR;
-  template_disk_inode.length = 0;
-  template_disk_inode.isdir = false;
-  template_disk_inode.magic = INODE_MAGIC;
-}
+block_sector_t inode_seek (struct inode_disk * inode_disk, block_sector_t logical_sector, bool create);
+static block_sector_t inode_fill_hole (struct inode_disk *, block_sector_t);
+static bool inode_fill_holes (struct inode_disk *, block_sector_t home,
+                              struct inode *, block_sector_t first,
+                              block_sector_t end, block_sector_t keep_first,
+                              block_sector_t keep_end);
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -101,172 +100,533 @@ sectors_to_bytes (size_t sectors)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    struct rwlock lock;                 /* Protects all below but the hints. */
+    struct rwlock dir_lock;             /* Directory entries, see inode_lock_dir(). */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+
+    /* Hints, updated by readers too, under HINT_LOCK. */
+    struct lock hint_lock;              /* Protects the hints. */
+    off_t ra_next;                      /* Offset a sequential read would continue at. */
+    block_sector_t ra_window;           /* Read-ahead window, in sectors. */
+    block_sector_t ra_end;              /* Logical sectors below this were read ahead. */
+    struct extent xlat[XLAT_CNT];       /* Recently used extents. */
+    size_t xlat_next;                   /* Slot in XLAT to replace next. */
+
+    block_sector_t resv_start;          /* Disk sectors reserved for appends. */
+    block_sector_t resv_cnt;            /* Number of reserved sectors. */
     struct inode_disk data;             /* Inode content. */
   };
 
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
-
-bool direct_block_init_if_need(block_sector_t *sector){
-  ASSERT(sector != NULL);
-  if(*sector == NOT_A_SECTOR){
-    if(!free_map_allocate(1, sector)){
-      PANIC("free_map_allocate_if_need: free_map_allocate failed");
-      *sector = NOT_A_SECTOR;
-      return false;
+static struct hash open_inodes;
+
+/* Protects OPEN_INODES and the OPEN_CNT of every open inode. */
+static struct lock open_inodes_lock;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int ((int) inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct inode *inode_a = hash_entry (a, struct inode, elem);
+  const struct inode *inode_b = hash_entry (b, struct inode, elem);
+  return inode_a->sector < inode_b->sector;
+}
+
+/* Returns the open inode for SECTOR, with a new reference to it
+   taken, or a null pointer if it is not open. */
+static struct inode *
+inode_find_open (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e == NULL)
+    return NULL;
+  struct inode *inode = hash_entry (e, struct inode, elem);
+  inode->open_cnt++;
+  return inode;
+}
+
+/* Returns the index of the last of the CNT EXTENTS that starts at
+   or before file sector SECTOR, or -1 if there is none. */
+static int
+extent_search (const struct extent *extents, size_t cnt,
+               block_sector_t sector)
+{
+  size_t lo = 0, hi = cnt;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (extents[mid].logical <= sector)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
-    cache_write(*sector, zeros);
-    return true;
-  }
-  return false;
-}
-
-bool indirect_block_init_if_need(block_sector_t *sector){
-  ASSERT(sector != NULL);
-  if(*sector == NOT_A_SECTOR){
-    if(!free_map_allocate(1, sector)){
-      /* PANIC("indirect_block_init_if_need: free_map_allocate failed"); */
-      *sector = NOT_A_SECTOR;
-      return false;
+  return (int) lo - 1;
+}
+
+/* Same as extent_search() for the CNT entries of an extent INDEX. */
+static int
+index_search (const struct extent_index *index, size_t cnt,
+              block_sector_t sector)
+{
+  size_t lo = 0, hi = cnt;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (index[mid].logical <= sector)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
-    cache_write(*sector, &template_disk_indirect_block);
-    return true;
-  }
-  return false;
-}
-
-bool double_indirect_block_init_if_need(block_sector_t *sector){
-  ASSERT(sector != NULL);
-  if(*sector == NOT_A_SECTOR){
-    if(!free_map_allocate(1, sector)){
-      /* PANIC("double_indirect_block_init_if_need: free_map_allocate failed"); */
-      *sector = NOT_A_SECTOR;
-      return false;
+  return (int) lo - 1;
+}
+
+/* Looks for the one of the CNT EXTENTS that maps file sector
+   SECTOR, copying it into *E if found. */
+static bool
+extent_find (const struct extent *extents, size_t cnt, block_sector_t sector,
+             struct extent *e)
+{
+  int i = extent_search (extents, cnt, sector);
+  if (i < 0 || sector - extents[i].logical >= extents[i].cnt)
+    return false;
+  *e = extents[i];
+  return true;
+}
+
+/* Adds the mapping of the LEN file sectors from LOGICAL, a hole, to
+   the disk sectors from PHYSICAL, to the *CNT sorted EXTENTS that
+   have room for MAX.  Grows a neighbouring extent instead if the
+   new sectors continue it on disk as well as in the file.  Returns
+   false if a new extent is needed but there is no room. */
+static bool
+extent_insert (struct extent *extents, size_t *cnt, size_t max,
+               block_sector_t logical, block_sector_t physical,
+               block_sector_t len)
+{
+  int i = extent_search (extents, *cnt, logical);
+  struct extent *prev = i >= 0 ? &extents[i] : NULL;
+  struct extent *next = (size_t) (i + 1) < *cnt ? &extents[i + 1] : NULL;
+  bool join_prev = prev != NULL
+                   && prev->logical + prev->cnt == logical
+                   && prev->physical + prev->cnt == physical;
+  bool join_next = next != NULL
+                   && next->logical == logical + len
+                   && next->physical == physical + len;
+
+  ASSERT (prev == NULL || prev->logical + prev->cnt <= logical);
+  ASSERT (next == NULL || next->logical >= logical + len);
+
+  if (join_prev)
+    {
+      prev->cnt += len;
+      if (join_next)
+        {
+          /* The new sectors close the gap between the two. */
+          prev->cnt += next->cnt;
+          memmove (next, next + 1, (*cnt - i - 2) * sizeof *extents);
+          (*cnt)--;
+        }
+      return true;
     }
-    cache_write(*sector, &template_disk_double_indirect_block);
-    return true;
-  }
-  return false;
-}
-/*  Seek the logical_sector in the inode_disk, return the physical_sector 
-    and try to create all the necessary blocks if need and write new indirect tables to the disk. 
-    The root node, (ie. inode) won't be written to the disk. This should be done manually.
-    This function should be called with aquiring locks of inode_disk and indirect blocks. 
-    return NOT_A_SECTOR if failed.
-    feature:
-      - Support large sparse files. (theoretically, 2TiB)
-      - Support large files. (theoretically, 2TiB)
-      - Try to create all the necessary blocks if need
-    caveats:
-      - All indirect/double indirect blocks should be first created in this function.
-      - The inode_disk should be written to the disk after this function.
-    deficiency:
-      - poor performance since frequent access to disks. (may be relieved by caching)
-      - complex integer division and modulo calculation.
-      - This function is not thread safe.
-*/
-block_sector_t inode_seek (struct inode_disk * inode_disk, block_sector_t logical_sector){
-  ASSERT(inode_disk != NULL);
-  /* seek in direct blocks */
-  if(logical_sector < DIRECT_BLOCK_SIZE){
-    direct_block_init_if_need(&inode_disk->direct_blocks[logical_sector]);
-    return inode_disk->direct_blocks[logical_sector];
-  }
-  /* seek in indirect blocks */
-  if(logical_sector < INDIRECT_BLOCK_SIZE + DIRECT_BLOCK_SIZE){
-    /* init indirect block if need */
-    indirect_block_init_if_need(&inode_disk->indirect_block);
-    if(inode_disk->indirect_block == NOT_A_SECTOR)
-      return NOT_A_SECTOR;
-    struct indirect_block_disk_t *disk_indirect_block = NULL;
-    disk_indirect_block = calloc (1, sizeof *disk_indirect_block);
-    /* read indirect block from disk */
-    cache_read(inode_disk->indirect_block, disk_indirect_block);
-    //TODO: caching indirect block
-    /* init direct block if need */
-    bool write_back_disk_indirect_block = direct_block_init_if_need(&disk_indirect_block->direct_blocks[logical_sector - DIRECT_BLOCK_SIZE]);
-    block_sector_t physical_sector = disk_indirect_block->direct_blocks[logical_sector - DIRECT_BLOCK_SIZE];
-    if(write_back_disk_indirect_block)
-      cache_write(inode_disk->indirect_block, disk_indirect_block);
-    free(disk_indirect_block);
-    return physical_sector;
-  }
-  /* seek in double indirect blocks */
-
-  unsigned long double_indirect_block_index = (logical_sector - INDIRECT_BLOCK_SIZE - DIRECT_BLOCK_SIZE) 
-                                              /
-                                              (INDIRECT_BLOCK_SIZE * DOUBLE_INDIRECT_BLOCK_SIZE);
-  unsigned long indirect_block_index = (logical_sector - INDIRECT_BLOCK_SIZE - DIRECT_BLOCK_SIZE) 
-                                       %
-                                       (INDIRECT_BLOCK_SIZE * DOUBLE_INDIRECT_BLOCK_SIZE)
-                                       /
-                                        INDIRECT_BLOCK_SIZE;
-                                       ;
-  unsigned long direct_block_index = (logical_sector - INDIRECT_BLOCK_SIZE - DIRECT_BLOCK_SIZE) 
-                                     %
-                                     (INDIRECT_BLOCK_SIZE * DOUBLE_INDIRECT_BLOCK_SIZE)
-                                     %
-                                      INDIRECT_BLOCK_SIZE;
-                                      /* equal to (logical_sector - INDIRECT_BLOCK_SIZE - DIRECT_BLOCK_SIZE) % INDIRECT_BLOCK_SIZE */
-  
-  if(double_indirect_block_index >= DOUBLE_INDIRECT_BLOCK_IN_INODE_SIZE){
-    return NOT_A_SECTOR;
-  }
+  if (join_next)
+    {
+      next->logical = logical;
+      next->physical = physical;
+      next->cnt += len;
+      return true;
+    }
+  if (*cnt >= max)
+    return false;
+  memmove (&extents[i + 2], &extents[i + 1],
+           (*cnt - i - 1) * sizeof *extents);
+  extents[i + 1].logical = logical;
+  extents[i + 1].physical = physical;
+  extents[i + 1].cnt = len;
+  (*cnt)++;
+  return true;
+}
 
-  /* init double indirect block if need */
-  double_indirect_block_init_if_need(&inode_disk->double_indirect_block[double_indirect_block_index]);
-  if(inode_disk->double_indirect_block[double_indirect_block_index] == NOT_A_SECTOR)
-    return NOT_A_SECTOR;
+/* Looks for the extent of INODE_DISK that maps file sector SECTOR,
+   copying it into *E if found.  A lookup in an indexed inode reads
+   one extent block, in place in the buffer cache. */
+static bool
+inode_find_extent (const struct inode_disk *inode_disk, block_sector_t sector,
+                   struct extent *e)
+{
+  if (inode_disk->depth == 0)
+    return extent_find (inode_disk->extents, inode_disk->cnt, sector, e);
+
+  int i = index_search (inode_disk->index, inode_disk->cnt, sector);
+  ASSERT (i >= 0);
+  struct cache_entry *entry = cache_get (inode_disk->index[i].block,
+                                         CACHE_READ);
+  const struct extent_block *block = (const struct extent_block *) entry->data;
+  ASSERT (block->magic == EXTENT_BLOCK_MAGIC);
+  bool found = extent_find (block->extents, block->cnt, sector, e);
+  cache_put (entry);
+  return found;
+}
+
+/* Moves the extents kept in INODE_DISK out to a new extent block
+   and makes it the inode's first and only indexed block.  Returns
+   false if no sector is free for the block. */
+static bool
+inode_deepen (struct inode_disk *inode_disk)
+{
+  block_sector_t sector;
+
+  ASSERT (inode_disk->depth == 0);
+  if (!free_map_allocate (1, &sector))
+    return false;
+
+  struct cache_entry *entry = cache_get (sector, CACHE_OVERWRITE);
+  struct extent_block *block = (struct extent_block *) entry->data;
+  memset (block, 0, sizeof *block);
+  block->magic = EXTENT_BLOCK_MAGIC;
+  block->cnt = inode_disk->cnt;
+  memcpy (block->extents, inode_disk->extents,
+          inode_disk->cnt * sizeof *inode_disk->extents);
+  cache_put (entry);
+
+  /* EXTENTS and INDEX overlap, so only now is INDEX free to use. */
+  inode_disk->depth = 1;
+  inode_disk->cnt = 1;
+  inode_disk->index[0].logical = 0;
+  inode_disk->index[0].block = sector;
+  return true;
+}
+
+/* Splits full extent block IDX of INODE_DISK in two, moving its
+   upper half to a new block indexed right after it.  Returns false
+   if the index is full or no sector is free for the block. */
+static bool
+inode_split (struct inode_disk *inode_disk, size_t idx)
+{
+  block_sector_t sector;
+
+  ASSERT (inode_disk->depth == 1);
+  if (inode_disk->cnt >= INODE_INDEX_CNT
+      || !free_map_allocate (1, &sector))
+    return false;
+
+  struct cache_entry *old_entry = cache_get (inode_disk->index[idx].block,
+                                             CACHE_WRITE);
+  struct cache_entry *new_entry = cache_get (sector, CACHE_OVERWRITE);
+  struct extent_block *old_block = (struct extent_block *) old_entry->data;
+  struct extent_block *new_block = (struct extent_block *) new_entry->data;
+  size_t keep = old_block->cnt / 2;
+
+  memset (new_block, 0, sizeof *new_block);
+  new_block->magic = EXTENT_BLOCK_MAGIC;
+  new_block->cnt = old_block->cnt - keep;
+  memcpy (new_block->extents, &old_block->extents[keep],
+          new_block->cnt * sizeof *new_block->extents);
+  old_block->cnt = keep;
+
+  memmove (&inode_disk->index[idx + 2], &inode_disk->index[idx + 1],
+           (inode_disk->cnt - idx - 1) * sizeof *inode_disk->index);
+  inode_disk->index[idx + 1].logical = new_block->extents[0].logical;
+  inode_disk->index[idx + 1].block = sector;
+  inode_disk->cnt++;
+
+  cache_put (new_entry);
+  cache_put (old_entry);
+  return true;
+}
+
+/* Maps the LEN file sectors of INODE_DISK from LOGICAL, which must
+   be a hole, to the disk sectors from PHYSICAL, growing the extent
+   tree as needed.  Returns false if the tree is full or a sector
+   for it cannot be allocated. */
+static bool
+inode_map (struct inode_disk *inode_disk, block_sector_t logical,
+           block_sector_t physical, block_sector_t len)
+{
+  if (inode_disk->depth == 0)
+    {
+      size_t cnt = inode_disk->cnt;
+      bool success = extent_insert (inode_disk->extents, &cnt,
+                                    INODE_EXTENT_CNT, logical, physical, len);
+      inode_disk->cnt = cnt;
+      if (success)
+        return true;
+      if (!inode_deepen (inode_disk))
+        return false;
+    }
+
+  int i = index_search (inode_disk->index, inode_disk->cnt, logical);
+  ASSERT (i >= 0);
+  while (true)
+    {
+      struct cache_entry *entry = cache_get (inode_disk->index[i].block,
+                                             CACHE_READ);
+      struct extent_block *block = (struct extent_block *) entry->data;
+      size_t cnt = block->cnt;
+      bool success = extent_insert (block->extents, &cnt, EXTENT_BLOCK_CNT,
+                                    logical, physical, len);
+      if (success)
+        {
+          block->cnt = cnt;
+          cache_mark_dirty (entry);
+        }
+      cache_put (entry);
+      if (success)
+        return true;
+
+      if (!inode_split (inode_disk, i))
+        return false;
+      if (logical >= inode_disk->index[i + 1].logical)
+        i++;
+    }
+}
+
+/* Releases every sector INODE_DISK maps, and its extent blocks. */
+static void
+inode_release (const struct inode_disk *inode_disk)
+{
+  if (inode_disk->depth == 0)
+    {
+      for (size_t i = 0; i < inode_disk->cnt; i++)
+        free_map_release (inode_disk->extents[i].physical,
+                          inode_disk->extents[i].cnt);
+      return;
+    }
+
+  for (size_t i = 0; i < inode_disk->cnt; i++)
+    {
+      struct cache_entry *entry = cache_get (inode_disk->index[i].block,
+                                             CACHE_READ);
+      const struct extent_block *block
+        = (const struct extent_block *) entry->data;
+      for (size_t j = 0; j < block->cnt; j++)
+        free_map_release (block->extents[j].physical, block->extents[j].cnt);
+      cache_put (entry);
+      free_map_release (inode_disk->index[i].block, 1);
+    }
+}
+
+/* Returns the disk sector that holds file sector LOGICAL_SECTOR of
+   INODE_DISK.  If it is a hole, returns NOT_A_SECTOR, or if CREATE,
+   allocates a zeroed sector for it first.  Returns NOT_A_SECTOR if
+   that allocation fails.  Extent blocks are written through the
+   buffer cache, but the inode itself is not: the caller must write
+   INODE_DISK back afterward. */
+block_sector_t
+inode_seek (struct inode_disk *inode_disk, block_sector_t logical_sector,
+            bool create)
+{
+  struct extent e;
+
+  ASSERT (inode_disk != NULL);
+  if (inode_find_extent (inode_disk, logical_sector, &e))
+    return e.physical + (logical_sector - e.logical);
+  return create ? inode_fill_hole (inode_disk, logical_sector) : NOT_A_SECTOR;
+}
+
+/* Like inode_seek(), but looks in INODE's translation cache of
+   recently used extents first, and adds the extent found to it
+   otherwise.  So consecutive sectors in the same extent cost one
+   extent tree lookup, not one each.  Mappings never change while
+   an inode is open, only grow, so cached extents never go stale. */
+static block_sector_t
+inode_translate (struct inode *inode, block_sector_t logical_sector,
+                 bool create)
+{
+  struct extent e;
+  block_sector_t sector = NOT_A_SECTOR;
+
+  lock_acquire (&inode->hint_lock);
+  for (size_t i = 0; i < XLAT_CNT; i++)
+    {
+      const struct extent *x = &inode->xlat[i];
+      if (logical_sector - x->logical < x->cnt)
+        {
+          sector = x->physical + (logical_sector - x->logical);
+          break;
+        }
+    }
 
-  /* read double indirect block from disk */
-  struct double_indirect_block_disk_t *disk_double_indirect_block = NULL;
-  disk_double_indirect_block = calloc (1, sizeof *disk_double_indirect_block);
-  cache_read(inode_disk->double_indirect_block[double_indirect_block_index], disk_double_indirect_block);
-  //TODO: caching double indirect block
+  lock_release (&inode->hint_lock);
 
-  /* init indirect block if need */
-  bool write_back_disk_double_indirect_block = indirect_block_init_if_need(&disk_double_indirect_block->indirect_block_disk[indirect_block_index]);
-  if(disk_double_indirect_block->indirect_block_disk[indirect_block_index] == NOT_A_SECTOR){
-    free(disk_double_indirect_block);
+  /* The extent tree itself is only changed under the inode lock,
+     which the caller holds, so walking it, which may wait for an
+     extent block to be read, needs no hint lock. */
+  if (sector == NOT_A_SECTOR
+      && inode_find_extent (&inode->data, logical_sector, &e))
+    {
+      lock_acquire (&inode->hint_lock);
+      inode->xlat[inode->xlat_next] = e;
+      inode->xlat_next = (inode->xlat_next + 1) % XLAT_CNT;
+      lock_release (&inode->hint_lock);
+      sector = e.physical + (logical_sector - e.logical);
+    }
+
+  if (sector != NOT_A_SECTOR)
+    return sector;
+  return create ? inode_fill_hole (&inode->data, logical_sector)
+                : NOT_A_SECTOR;
+}
+
+/* Returns the disk sector where the data for file sector
+   LOGICAL_SECTOR of INODE_DISK would best go: right after the
+   previous file sector, or if that is a hole, right after HOME,
+   the inode's own sector. */
+static block_sector_t
+inode_goal (const struct inode_disk *inode_disk, block_sector_t home,
+            block_sector_t logical_sector)
+{
+  struct extent e;
+
+  if (logical_sector > 0
+      && inode_find_extent (inode_disk, logical_sector - 1, &e))
+    return e.physical + (logical_sector - e.logical);
+  return home != NOT_A_SECTOR ? home + 1 : 0;
+}
+
+/* Allocates a zeroed sector for file sector LOGICAL_SECTOR of
+   INODE_DISK, a hole, and returns it, or NOT_A_SECTOR on failure. */
+static block_sector_t
+inode_fill_hole (struct inode_disk *inode_disk, block_sector_t logical_sector)
+{
+  block_sector_t sector;
+
+  if (free_map_allocate_near (inode_goal (inode_disk, NOT_A_SECTOR,
+                                          logical_sector), 1, &sector) == 0)
     return NOT_A_SECTOR;
-  }
+  if (!inode_map (inode_disk, logical_sector, sector, 1))
+    {
+      free_map_release (sector, 1);
+      return NOT_A_SECTOR;
+    }
+  cache_write (sector, zeros);
+  return sector;
+}
 
-  /* read indirect block from disk */
-  struct indirect_block_disk_t *disk_indirect_block = NULL;
-  disk_indirect_block = calloc (1, sizeof *disk_indirect_block);
-  cache_read(disk_double_indirect_block->indirect_block_disk[indirect_block_index], disk_indirect_block);
-  //TODO: caching indirect block
+/* Gives INODE's reserved sectors back to the free map. */
+static void
+inode_unreserve (struct inode *inode)
+{
+  if (inode->resv_cnt > 0)
+    free_map_release (inode->resv_start, inode->resv_cnt);
+  inode->resv_cnt = 0;
+}
 
-  /* init the direct block in the indirect block if need */
-  bool write_back_disk_indirect_block = direct_block_init_if_need(&disk_indirect_block->direct_blocks[direct_block_index]);
-  if(write_back_disk_indirect_block)
-    cache_write(disk_double_indirect_block->indirect_block_disk[indirect_block_index], disk_indirect_block);
-  if(write_back_disk_double_indirect_block)
-    cache_write(inode_disk->double_indirect_block[double_indirect_block_index], disk_double_indirect_block);
+/* Allocates up to LEN consecutive disk sectors, preferably starting
+   at GOAL, and returns the first, storing the number allocated in
+   *CNT.  If INODE is non-null, sectors starting at GOAL are taken
+   from its reservation first, and if PREALLOC, PREALLOC_SECTORS more
+   are allocated along with them and become its new reservation, so
+   that the next extending write can continue the same run even if
+   another file is growing at the same time.  Returns NOT_A_SECTOR if
+   the disk is full. */
+static block_sector_t
+inode_alloc_run (struct inode *inode, block_sector_t goal, block_sector_t len,
+                 bool prealloc, block_sector_t *cnt)
+{
+  block_sector_t start;
+  size_t n;
 
-  block_sector_t physical_sector = disk_indirect_block->direct_blocks[direct_block_index];
+  if (inode != NULL && inode->resv_cnt > 0 && inode->resv_start == goal)
+    {
+      *cnt = len < inode->resv_cnt ? len : inode->resv_cnt;
+      inode->resv_start += *cnt;
+      inode->resv_cnt -= *cnt;
+      return goal;
+    }
 
-  free(disk_double_indirect_block);
-  free(disk_indirect_block);
-  return physical_sector;
+  prealloc = prealloc && inode != NULL;
+  n = free_map_allocate_near (goal, len + (prealloc ? PREALLOC_SECTORS : 0),
+                              &start);
+  if (n == 0)
+    return NOT_A_SECTOR;
+  if (n > len)
+    {
+      inode_unreserve (inode);
+      inode->resv_start = start + len;
+      inode->resv_cnt = n - len;
+      n = len;
+    }
+  *cnt = n;
+  return start;
+}
 
-  // /* logical_sector is too large */
-  // return NOT_A_SECTOR;
+/* Maps every hole among file sectors FIRST...END-1 of INODE_DISK to
+   newly allocated disk sectors, a whole run of them per hole where
+   the free map allows, placed right after the sectors before it (or
+   HOME, the inode's sector, for the start of the file).  New
+   sectors are zeroed, except for KEEP_FIRST...KEEP_END-1 that the
+   caller is about to overwrite in full.  INODE, if non-null, is the
+   open inode whose append reservation to use.
+   Returns false if the disk or the extent tree fills up; the holes
+   filled up to that point stay filled. */
+static bool
+inode_fill_holes (struct inode_disk *inode_disk, block_sector_t home,
+                  struct inode *inode, block_sector_t first,
+                  block_sector_t end, block_sector_t keep_first,
+                  block_sector_t keep_end)
+{
+  block_sector_t eof = bytes_to_sectors (inode_disk->length);
+  block_sector_t sector = first;
+  struct extent e;
+
+  while (sector < end)
+    {
+      if (inode_find_extent (inode_disk, sector, &e))
+        {
+          sector = e.logical + e.cnt;
+          continue;
+        }
+
+      /* Length of the hole, as far as END. */
+      block_sector_t len = 1;
+      while (sector + len < end
+             && !inode_find_extent (inode_disk, sector + len, &e))
+        len++;
+
+      block_sector_t cnt;
+      block_sector_t start = inode_alloc_run (
+          inode, inode_goal (inode_disk, home, sector), len,
+          sector + len >= eof, &cnt);
+      if (start == NOT_A_SECTOR)
+        return false;
+      if (!inode_map (inode_disk, sector, start, cnt))
+        {
+          free_map_release (start, cnt);
+          return false;
+        }
+      for (block_sector_t i = 0; i < cnt; i++)
+        if (sector + i < keep_first || sector + i >= keep_end)
+          cache_write (start + i, zeros);
+      sector += cnt;
+    }
+  return true;
 }
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
-  template_init();
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
 }
 
 
@@ -289,20 +649,17 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode == NULL)
     return false;
-  /* init inode */
-  memcpy(disk_inode, &template_disk_inode, sizeof *disk_inode);
   
   size_t sectors = bytes_to_sectors (length);
   disk_inode->length = length;
   disk_inode->magic = INODE_MAGIC;
   disk_inode->isdir = isdir;
-  /* creates all nodes by inode_seek */
-  for(size_t i = 0; i < sectors; i++){
-      block_sector_t physical_sector = inode_seek(disk_inode, i);
-      if(physical_sector == NOT_A_SECTOR){
-          free (disk_inode);
-          return false;
-        }
+  /* allocates all sectors, in as few runs as possible */
+  if (!inode_fill_holes (disk_inode, sector, NULL, 0, sectors, 0, 0))
+    {
+      inode_release (disk_inode);
+      free (disk_inode);
+      return false;
     }
   cache_write (sector, disk_inode);
   free (disk_inode);
@@ -315,21 +672,14 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  sector %= FD_GROW_MAGIC;
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *other;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  lock_acquire (&open_inodes_lock);
+  inode = inode_find_open (sector);
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -337,12 +687,34 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  rwlock_init (&inode->lock);
+  lock_init (&inode->hint_lock);
+  rwlock_init (&inode->dir_lock);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->ra_next = 0;
+  inode->ra_window = 0;
+  inode->ra_end = 0;
+  memset (inode->xlat, 0, sizeof inode->xlat);
+  inode->xlat_next = 0;
+  inode->resv_start = NOT_A_SECTOR;
+  inode->resv_cnt = 0;
   cache_read (inode->sector, &inode->data);
+
+  /* Publish it, unless someone else opened the inode while we were
+     reading it in. */
+  lock_acquire (&open_inodes_lock);
+  other = inode_find_open (sector);
+  if (other == NULL)
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (other != NULL)
+    {
+      free (inode);
+      return other;
+    }
   return inode;
 }
 
@@ -351,7 +723,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -371,72 +747,20 @@ inode_close (struct inode *inode)
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
-  //TODO: closes 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0){
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+  lock_acquire (&open_inodes_lock);
+  bool last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last){
+      /* No one can find it any more. */
+      inode_unreserve (inode);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) {
-        /* free all direct blocks */
-        for(int i = 0; i < DIRECT_BLOCK_SIZE; i++){
-          if(inode->data.direct_blocks[i] != NOT_A_SECTOR)
-            free_map_release (inode->data.direct_blocks[i], 1);
-        }
-        struct double_indirect_block_disk_t * double_indirect_block_disk = NULL;
-        struct indirect_block_disk_t * indirect_block_disk = NULL;
-
-        double_indirect_block_disk = malloc(sizeof *double_indirect_block_disk);
-        indirect_block_disk = malloc(sizeof *indirect_block_disk);
-
-        if(double_indirect_block_disk == NULL || indirect_block_disk == NULL){
-          free(double_indirect_block_disk);
-          free(indirect_block_disk);
-          PANIC("memory allocation failed while freeing filesystem blocks");
-        }
-
-        /* free all indirect blocks */
-        if (inode->data.indirect_block != NOT_A_SECTOR){
-
-          cache_read(inode->data.indirect_block, indirect_block_disk);
-          for(int i = 0; i < INDIRECT_BLOCK_SIZE; i++){
-            block_sector_t physical_sector = indirect_block_disk->direct_blocks[i];
-            if(physical_sector != NOT_A_SECTOR)
-              free_map_release (physical_sector, 1);
-          }
-          free_map_release (inode->data.indirect_block, 1);
-        }
-
-        /* free all double indirect blocks */
-        for(int _i = 0; _i < DOUBLE_INDIRECT_BLOCK_IN_INODE_SIZE; ++_i){
-          if (inode->data.double_indirect_block[_i] != NOT_A_SECTOR){
-            cache_read(inode->data.double_indirect_block[_i], double_indirect_block_disk);
-
-            /* free all indirect blocks inside the double indirect block*/
-            for(int i = 0; i < DOUBLE_INDIRECT_BLOCK_SIZE; i++){
-              block_sector_t indirect_block = double_indirect_block_disk->indirect_block_disk[i];
-              if (indirect_block == NOT_A_SECTOR)
-                continue;
-
-              cache_read(indirect_block, indirect_block_disk);
-
-              /* free all direct blocks inside the indirect block */
-              for(int i = 0; i < INDIRECT_BLOCK_SIZE; ++i){
-                block_sector_t physical_sector = indirect_block_disk->direct_blocks[i];
-                if(physical_sector != NOT_A_SECTOR)
-                  free_map_release (physical_sector, 1);
-              }
-              free_map_release(indirect_block, 1);
-
-            }
-
-            free_map_release (inode->data.double_indirect_block[_i], 1);
-          }
-        }
-
-        free(double_indirect_block_disk);
-        free(indirect_block_disk);
+        inode_release (&inode->data);
         free_map_release (inode->sector, 1);
       }
       else { /* not removed, excute write back */
@@ -453,127 +777,178 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  rwlock_acquire_write (&inode->lock);
   inode->removed = true;
+  rwlock_release_write (&inode->lock);
+}
+
+/* Updates INODE's sequential stream detection after a read of
+   bytes START...END, and queues read-ahead for the sectors that
+   follow if the read continued where the previous one stopped.
+   The window doubles on each sequential read up to READ_AHEAD_MAX
+   and collapses on a seek; sectors already queued by an earlier
+   read are not queued again. */
+static void
+inode_read_ahead (struct inode *inode, off_t start, off_t end)
+{
+  block_sector_t sectors[READ_AHEAD_MAX];
+  size_t cnt = 0;
+
+  lock_acquire (&inode->hint_lock);
+  if (start != inode->ra_next || start == 0)
+    {
+      /* Random access, or the first read of a stream. */
+      inode->ra_next = end;
+      inode->ra_window = start == 0 ? READ_AHEAD_MIN : 0;
+      inode->ra_end = 0;
+      if (inode->ra_window == 0)
+        {
+          lock_release (&inode->hint_lock);
+          return;
+        }
+    }
+  else
+    {
+      inode->ra_next = end;
+      inode->ra_window = inode->ra_window == 0 ? READ_AHEAD_MIN
+                                               : inode->ra_window * 2;
+      if (inode->ra_window > READ_AHEAD_MAX)
+        inode->ra_window = READ_AHEAD_MAX;
+    }
+
+  block_sector_t first = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  block_sector_t last = first + inode->ra_window;
+  block_sector_t eof = bytes_to_sectors (inode->data.length);
+  if (first < inode->ra_end)
+    first = inode->ra_end;
+  if (last > eof)
+    last = eof;
+  if (first < last)
+    inode->ra_end = last;
+  lock_release (&inode->hint_lock);
+
+  for (block_sector_t i = first; i < last; i++)
+    {
+      block_sector_t sector = inode_translate (inode, i, false);
+      if (sector == NOT_A_SECTOR)
+        break;
+      sectors[cnt++] = sector;
+    }
+  cache_read_ahead (sectors, cnt);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Data is copied straight out of the buffer cache, with the inode
+   and the sector's cache entry locked, so BUFFER must not fault: a
+   user buffer must have been pinned in memory by the caller, as the
+   system calls do. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   ASSERT(inode != NULL);
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = malloc (BLOCK_SECTOR_SIZE);
-  if(bounce == NULL){
-    return 0;
-  }
-  if (size == 0){
-    free(bounce);
-    return 0;
-  }
-  if (offset >= inode->data.length){
-    free(bounce);
-    return 0;
-  }
-
-  if (offset + size > inode->data.length)
+
+  rwlock_acquire_read (&inode->lock);
+  if (offset >= inode->data.length)
+    size = 0;
+  else if (offset + size > inode->data.length)
     size = inode->data.length - offset;
-  /* read the first sector */
-  block_sector_t first = offset / BLOCK_SECTOR_SIZE;
-  block_sector_t sector_idx = inode_seek(&inode->data, first);
-  if(sector_idx == NOT_A_SECTOR){
-    free (bounce);
-    return 0;
-  }
-  cache_read(sector_idx, bounce);
-  int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-  int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-  int chunk_size = size < sector_left ? size : sector_left;
-  int logical_sector_cnt = 1;
-  memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
-  bytes_read += chunk_size;
-  /* read the rest sectors */
-  while (bytes_read < size){
-      block_sector_t sector_idx = inode_seek(&inode->data, first + logical_sector_cnt);
-      if(sector_idx == NOT_A_SECTOR){
-        free (bounce);
-        return 0;
-      }
-      cache_read(sector_idx, bounce);
-      int chunk_size = size - bytes_read < BLOCK_SECTOR_SIZE ? size - bytes_read : BLOCK_SECTOR_SIZE;
-      memcpy(buffer + bytes_read, bounce, chunk_size);
+
+  while (size > 0) 
+    {
+      block_sector_t sector_idx = inode_translate (inode,
+                                                   offset / BLOCK_SECTOR_SIZE,
+                                                   false);
+
+      /* Starting byte offset within sector, bytes to copy from it. */
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      if (sector_idx == NOT_A_SECTOR)
+        /* A hole reads as zeros. */
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        {
+          struct cache_entry *entry = cache_get (sector_idx, CACHE_READ);
+          memcpy (buffer + bytes_read, entry->data + sector_ofs, chunk_size);
+          cache_put (entry);
+        }
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
       bytes_read += chunk_size;
-      logical_sector_cnt ++;
     }
-  free (bounce);
+  if (bytes_read > 0)
+    inode_read_ahead (inode, offset - bytes_read, offset);
+  rwlock_release_read (&inode->lock);
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.  Writing past end of file
+   extends the inode.
+   Data is copied straight into the buffer cache; sectors written
+   in full are not read from disk first.  As for inode_read_at(),
+   BUFFER must not fault. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_write (&inode->lock);
   if (inode->deny_write_cnt)
-    return 0;
-  if (size == 0)
-    return 0;
-  bounce = malloc (BLOCK_SECTOR_SIZE);
-  /* write the first sector */
-  block_sector_t first = offset / BLOCK_SECTOR_SIZE;
-  block_sector_t sector_idx = inode_seek(&inode->data, first);
-  if(sector_idx == NOT_A_SECTOR){
-    free (bounce);
-    return 0;
-  }
-  cache_read(sector_idx, bounce);
-  int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-  int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-  int chunk_size = size < sector_left ? size : sector_left;
-  memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-  cache_write (sector_idx, bounce);
-  bytes_written += chunk_size;
-  /* write the rest sectors */
-  int logical_sector_cnt = 0;
-  ++ logical_sector_cnt;
-
-  while (bytes_written < size){
-    block_sector_t sector_idx = inode_seek(&inode->data, first + logical_sector_cnt);
-    if(sector_idx == NOT_A_SECTOR)
-      break;
-    int chunk_size = size - bytes_written < BLOCK_SECTOR_SIZE ? size - bytes_written : BLOCK_SECTOR_SIZE;
-    if (chunk_size > 0){
-        if (chunk_size == BLOCK_SECTOR_SIZE) {
-            /* Write full sector directly to disk. */
-            cache_write (sector_idx, buffer + bytes_written);
-          }
-        else {
-            cache_read (sector_idx, bounce);
-            memcpy (bounce, buffer + bytes_written, chunk_size);
-            cache_write (sector_idx, bounce);
-          }
-        /* Advance. */
-        bytes_written += chunk_size;
-      }
-    logical_sector_cnt ++;
-  }
-
-  free (bounce);
-  /* update inode length */
-  if (offset + bytes_written > inode->data.length)
-      inode->data.length = offset + bytes_written;
-  /* write disk_inode back*/
-  cache_write(inode->sector, &inode->data);
+    size = 0;
+
+  /* Allocate all the sectors this write needs at once, so that they
+     come out as one run, without zeroing those it fully covers. */
+  if (size > 0)
+    inode_fill_holes (&inode->data, inode->sector, inode,
+                      offset / BLOCK_SECTOR_SIZE,
+                      DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE),
+                      DIV_ROUND_UP (offset, BLOCK_SECTOR_SIZE),
+                      (offset + size) / BLOCK_SECTOR_SIZE);
+
+  while (size > 0) 
+    {
+      block_sector_t sector_idx = inode_translate (inode,
+                                                   offset / BLOCK_SECTOR_SIZE,
+                                                   true);
+      if (sector_idx == NOT_A_SECTOR)
+        break;
+
+      /* Starting byte offset within sector, bytes to copy into it. */
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      struct cache_entry *entry = cache_get (sector_idx,
+          chunk_size == BLOCK_SECTOR_SIZE ? CACHE_OVERWRITE : CACHE_WRITE);
+      memcpy (entry->data + sector_ofs, buffer + bytes_written, chunk_size);
+      cache_put (entry);
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+
+  if (bytes_written > 0)
+    {
+      /* update inode length */
+      if (offset > inode->data.length)
+          inode->data.length = offset;
+      /* write disk_inode back*/
+      cache_write(inode->sector, &inode->data);
+    }
+  rwlock_release_write (&inode->lock);
   return bytes_written;
 }
 
@@ -582,8 +957,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -592,9 +969,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -619,6 +998,52 @@ bool inode_is_file(const struct inode * inode){
   return !inode->data.isdir;
 }
 
+/* Returns the number of hash buckets of directory INODE, or 0 if it
+   is a plain linear directory. */
+uint32_t
+inode_dir_buckets (const struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  return inode->data.dir_buckets;
+}
+
+/* Records that directory INODE is now hashed into BUCKETS buckets. */
+void
+inode_set_dir_buckets (struct inode *inode, uint32_t buckets)
+{
+  ASSERT (inode_is_dir (inode));
+  rwlock_acquire_write (&inode->lock);
+  inode->data.dir_buckets = buckets;
+  cache_write (inode->sector, &inode->data);
+  rwlock_release_write (&inode->lock);
+}
+
+/* Locks directory INODE against changes to its entries by other
+   threads, or if EXCLUSIVE, so as to change them; any number of
+   threads may hold it shared for lookups.  Reads and writes of its
+   data still take the inode's own lock, so this may be held across
+   them. */
+void
+inode_lock_dir (struct inode *inode, bool exclusive)
+{
+  ASSERT (inode_is_dir (inode));
+  if (exclusive)
+    rwlock_acquire_write (&inode->dir_lock);
+  else
+    rwlock_acquire_read (&inode->dir_lock);
+}
+
+/* Unlocks directory INODE, locked with inode_lock_dir() with the
+   same EXCLUSIVE. */
+void
+inode_unlock_dir (struct inode *inode, bool exclusive)
+{
+  if (exclusive)
+    rwlock_release_write (&inode->dir_lock);
+  else
+    rwlock_release_read (&inode->dir_lock);
+}
+
 bool inode_is_removed(const struct inode *inode){
   ASSERT(inode != NULL);
   ASSERT(inode->data.magic == INODE_MAGIC);
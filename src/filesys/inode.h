@@ -2,7 +2,6 @@
 #define FILESYS_INODE_H
 #define NOT_A_SECTOR ((unsigned) -1)
 #define NOT_A_FD -1
-#define FD_GROW_MAGIC 20000
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
@@ -25,6 +24,10 @@ bool inode_is_dir (const struct inode *);
 bool inode_is_file (const struct inode *);
 bool inode_is_removed (const struct inode *);
 bool inode_is_opened (const struct inode *);
+uint32_t inode_dir_buckets (const struct inode *);
+void inode_set_dir_buckets (struct inode *, uint32_t);
+void inode_lock_dir (struct inode *, bool exclusive);
+void inode_unlock_dir (struct inode *, bool exclusive);
 
 
 #endif /* filesys/inode.h */
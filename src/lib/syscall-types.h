@@ -0,0 +1,45 @@
+#ifndef __LIB_SYSCALL_TYPES_H
+#define __LIB_SYSCALL_TYPES_H
+
+#include <stddef.h>
+
+/* Structures that system calls take from user memory, shared by
+   user programs and the kernel so that both agree on their layout. */
+
+/* One buffer of a readv() or writev(). */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    size_t iov_len;             /* Length of the buffer in bytes. */
+  };
+
+/* Most buffers one readv() or writev() accepts. */
+#define IOV_MAX 1024
+
+/* Most arguments a system call takes. */
+#define SYSCALL_MAX_ARGS 4
+
+/* A system call queued in a struct syscall_ring. */
+struct syscall_req
+  {
+    int nr;                     /* System call number, a SYS_* value. */
+    int args[SYSCALL_MAX_ARGS]; /* Arguments, as passed to the call. */
+    int result;                 /* Return value, set when carried out. */
+  };
+
+/* A ring of queued system calls, in the program's own memory.
+   The program fills entries[tail % size] and advances TAIL; the
+   kernel, on submit(), carries out each entry from HEAD up to
+   TAIL, storing its result in it and advancing HEAD.  SIZE must
+   be a power of 2 no larger than SYSCALL_RING_MAX. */
+struct syscall_ring
+  {
+    unsigned head;              /* Next entry to carry out. */
+    unsigned tail;              /* Next entry to fill. */
+    unsigned size;              /* Number of entries. */
+    struct syscall_req entries[];
+  };
+
+#define SYSCALL_RING_MAX 1024
+
+#endif /* lib/syscall-types.h */
@@ -2,7 +2,9 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
+#include <syscall-types.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +47,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int pread (int fd, void *buffer, unsigned length, unsigned position);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned position);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int submit (struct syscall_ring *);
+
 #endif /* lib/user/syscall.h */
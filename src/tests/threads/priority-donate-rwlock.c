@@ -0,0 +1,58 @@
+/* The main thread acquires a readers-writer lock for reading.
+   Then it creates a higher-priority thread that blocks acquiring
+   it for writing, which must donate its priority to the main
+   thread, the reader it waits for.  A thread of medium priority,
+   created next, must not run until the main thread releases the
+   lock and the writer is done. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread_func;
+static thread_func medium_thread_func;
+
+void
+test_priority_donate_rwlock (void) 
+{
+  struct rwlock rwlock;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock);
+  rwlock_acquire_read (&rwlock);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &rwlock,
+                 NOT_A_FD);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  thread_create ("medium", PRI_DEFAULT + 1, medium_thread_func, NULL,
+                 NOT_A_FD);
+  msg ("Medium thread should not have run yet.");
+  rwlock_release_read (&rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+  msg ("writer, medium must already have finished, in that order.");
+}
+
+static void
+writer_thread_func (void *rwlock_) 
+{
+  struct rwlock *rwlock = rwlock_;
+
+  rwlock_acquire_write (rwlock);
+  msg ("writer: got the lock");
+  rwlock_release_write (rwlock);
+  msg ("writer: done");
+}
+
+static void
+medium_thread_func (void *aux UNUSED) 
+{
+  msg ("medium: done");
+}
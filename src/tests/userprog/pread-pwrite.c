@@ -0,0 +1,33 @@
+/* Reads and writes a file at given positions with pread() and
+   pwrite(), and checks that the file position does not move. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  byte_cnt = pread (handle, buf, 20, 10);
+  if (byte_cnt != 20)
+    fail ("pread() returned %d instead of 20", byte_cnt);
+  compare_bytes (buf, sample + 10, 20, 10, "sample.txt");
+  if (tell (handle) != 0)
+    fail ("pread() moved the file position to %u", tell (handle));
+
+  byte_cnt = pwrite (handle, "SCUFFED", 7, 33);
+  if (byte_cnt != 7)
+    fail ("pwrite() returned %d instead of 7", byte_cnt);
+  if (tell (handle) != 0)
+    fail ("pwrite() moved the file position to %u", tell (handle));
+
+  memcpy (sample + 33, "SCUFFED", 7);
+  check_file_handle (handle, "sample.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,40 @@
+/* Writes a file from several buffers with writev() and reads it
+   back into differently split buffers with readv(). */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  struct iovec iov[3];
+  size_t size = sizeof sample - 1;
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  iov[0].iov_base = sample;
+  iov[0].iov_len = 1;
+  iov[1].iov_base = sample + 1;
+  iov[1].iov_len = 100;
+  iov[2].iov_base = sample + 101;
+  iov[2].iov_len = size - 101;
+  byte_cnt = writev (handle, iov, 3);
+  if (byte_cnt != (int) size)
+    fail ("writev() returned %d instead of %zu", byte_cnt, size);
+
+  seek (handle, 0);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 50;
+  iov[1].iov_base = buf + 50;
+  iov[1].iov_len = sizeof buf - 50;
+  byte_cnt = readv (handle, iov, 2);
+  if (byte_cnt != (int) size)
+    fail ("readv() returned %d instead of %zu", byte_cnt, size);
+  compare_bytes (buf, sample, size, 0, "test.txt");
+  msg ("verified contents of \"test.txt\"");
+}
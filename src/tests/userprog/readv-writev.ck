@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "test.txt"
+(readv-writev) open "test.txt"
+(readv-writev) verified contents of "test.txt"
+(readv-writev) end
+readv-writev: exit(0)
+EOF
+pass;
@@ -0,0 +1,62 @@
+/* Queues several system calls in a ring and carries them out with
+   one submit(), then checks their results. */
+
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RING_SIZE 8
+
+static struct
+  {
+    struct syscall_ring ring;
+    struct syscall_req entries[RING_SIZE];
+  }
+r;
+
+static void
+queue (int nr, int arg0, int arg1, int arg2)
+{
+  struct syscall_req *req = &r.ring.entries[r.ring.tail % RING_SIZE];
+  req->nr = nr;
+  req->args[0] = arg0;
+  req->args[1] = arg1;
+  req->args[2] = arg2;
+  req->result = 0;
+  r.ring.tail++;
+}
+
+void
+test_main (void) 
+{
+  int handle, done;
+
+  r.ring.size = RING_SIZE;
+  queue (SYS_CREATE, (int) "ring.txt", 0, 0);
+  queue (SYS_OPEN, (int) "ring.txt", 0, 0);
+  done = submit (&r.ring);
+  if (done != 2)
+    fail ("submit() returned %d instead of 2", done);
+  CHECK (r.ring.entries[0].result, "create \"ring.txt\"");
+  CHECK ((handle = r.ring.entries[1].result) > 1, "open \"ring.txt\"");
+
+  queue (SYS_WRITE, handle, (int) sample, sizeof sample - 1);
+  queue (SYS_SEEK, handle, 0, 0);
+  queue (SYS_FILESIZE, handle, 0, 0);
+  queue (SYS_SUBMIT, (int) &r.ring, 0, 0);
+  done = submit (&r.ring);
+  if (done != 4)
+    fail ("submit() returned %d instead of 4", done);
+  if (r.ring.entries[2].result != sizeof sample - 1)
+    fail ("write returned %d", r.ring.entries[2].result);
+  if (r.ring.entries[4].result != sizeof sample - 1)
+    fail ("filesize returned %d", r.ring.entries[4].result);
+  if (r.ring.entries[5].result != -1)
+    fail ("nested submit returned %d", r.ring.entries[5].result);
+  if (r.ring.head != r.ring.tail)
+    fail ("ring head %u short of tail %u", r.ring.head, r.ring.tail);
+
+  check_file_handle (handle, "ring.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(submit-ring) begin
+(submit-ring) create "ring.txt"
+(submit-ring) open "ring.txt"
+(submit-ring) verified contents of "ring.txt"
+(submit-ring) end
+submit-ring: exit(0)
+EOF
+pass;
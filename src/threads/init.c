@@ -58,6 +58,9 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -cache: Number of sectors in the buffer cache. */
+static size_t cache_sectors = CACHE_SIZE;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -132,7 +135,7 @@ main (void)
   ide_init ();
   locate_block_devices ();
 
-  cache_init ();
+  cache_init (cache_sectors);
 
   filesys_init (format_filesys);
 #endif
@@ -263,6 +266,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          int sectors = value != NULL ? atoi (value) : 0;
+          if (sectors <= 0)
+            PANIC ("bad -cache size `%s' (use -h for help)",
+                   value != NULL ? value : "");
+          cache_sectors = sectors;
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -389,6 +400,7 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=COUNT       Cache up to COUNT disk sectors in memory.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
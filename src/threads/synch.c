@@ -316,6 +316,199 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/* Initializes RWLOCK.  A readers-writer lock may be held by any
+   number of readers at once, or by a single writer.  Writers are
+   preferred: once a writer is waiting, readers that arrive after
+   it wait until it is done, so a steady stream of readers cannot
+   starve it.  Like locks, readers-writer locks are not
+   recursive. */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  rwlock->readers = 0;
+  rwlock->drainer = NULL;
+  sema_init (&rwlock->drained, 0);
+#ifdef THREADS
+  list_init (&rwlock->holders);
+#endif
+}
+
+/* Acquires RWLOCK for reading, sleeping while a writer holds it
+   or is waiting for it.  Threads that wait here donate their
+   priority to the writer through the lock it holds.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rwlock->lock);
+  old_level = intr_disable ();
+  rwlock->readers++;
+#ifdef THREADS
+  {
+    struct thread *cur = thread_current ();
+    struct rwlock_hold *hold = cur->read_holds;
+
+    while (hold->rwlock != NULL)
+      {
+        hold++;
+        ASSERT (hold < cur->read_holds + RWLOCK_HOLD_MAX);
+      }
+    hold->rwlock = rwlock;
+    hold->thread = cur;
+    list_push_back (&rwlock->holders, &hold->elem);
+  }
+#endif
+  intr_set_level (old_level);
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading.  The last reader out lets a waiting writer in. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  enum intr_level old_level;
+  bool drained;
+
+  ASSERT (rwlock != NULL);
+
+  /* Readers do not take LOCK on the way out, since a writer may
+     be holding it while it waits for them. */
+  old_level = intr_disable ();
+  ASSERT (rwlock->readers > 0);
+  drained = rwlock->drainer != NULL;
+#ifdef THREADS
+  {
+    struct thread *cur = thread_current ();
+    struct rwlock_hold *hold = cur->read_holds;
+
+    while (hold->rwlock != rwlock)
+      {
+        hold++;
+        ASSERT (hold < cur->read_holds + RWLOCK_HOLD_MAX);
+      }
+    list_remove (&hold->elem);
+    hold->rwlock = NULL;
+
+    /* Give back what a waiting writer donated through this hold. */
+    if (!thread_mlfqs && drained)
+      {
+        cur->priority = cur->init_priority;
+        thread_pushup_priority (cur);
+      }
+  }
+#endif
+  if (--rwlock->readers == 0 && drained)
+    {
+      rwlock->drainer = NULL;
+      sema_up (&rwlock->drained);
+    }
+  intr_set_level (old_level);
+#ifdef THREADS
+  /* Only a waiting writer can have raised our priority or be
+     woken by this release, so there is nothing to yield to
+     otherwise. */
+  if (drained)
+    thread_yield ();
+#endif
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it.  Holding LOCK from here on keeps new readers out and
+   makes waiters donate their priority to us, which we pass on to
+   the readers we wait for.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rwlock->lock);
+  old_level = intr_disable ();
+  while (rwlock->readers > 0)
+    {
+      rwlock->drainer = cur;
+#ifdef THREADS
+      cur->draining_rwlock = rwlock;
+      if (!thread_mlfqs)
+        rwlock_donate (rwlock);
+#endif
+      sema_down (&rwlock->drained);
+    }
+#ifdef THREADS
+  cur->draining_rwlock = NULL;
+#endif
+  intr_set_level (old_level);
+}
+
+#ifdef THREADS
+/* Raises each reader of RWLOCK to the priority of the writer
+   waiting for them, if that is higher, and passes it on along
+   whatever the reader itself waits for.  Interrupts must be off. */
+void
+rwlock_donate (struct rwlock *rwlock)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (rwlock->drainer == NULL)
+    return;
+  for (e = list_begin (&rwlock->holders); e != list_end (&rwlock->holders);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct rwlock_hold, elem)->thread;
+
+      if (t->priority >= rwlock->drainer->priority)
+        continue;
+      t->priority = rwlock->drainer->priority;
+      if (t->waiting_lock != NULL
+          && t->waiting_lock->holder->priority < t->priority)
+        thread_forward_priority (t, t->waiting_lock);
+      else if (t->draining_rwlock != NULL)
+        rwlock_donate (t->draining_rwlock);
+    }
+}
+#endif
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock->readers == 0);
+
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise.  Whether it holds it for reading is not
+   tracked. */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return lock_held_by_current_thread (&rwlock->lock);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
@@ -30,6 +30,46 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Readers-writer lock.  Any number of readers, or a single
+   writer, may hold it at once.  A writer holds LOCK for its whole
+   critical section, so it gets priority donation from threads
+   waiting behind it; readers hold LOCK only while they arrive, so
+   once a writer is waiting for the readers to drain, no new reader
+   gets in. */
+struct rwlock
+  {
+    struct lock lock;           /* Held by the writer. */
+    unsigned readers;           /* Number of readers holding it. */
+    struct thread *drainer;     /* Writer waiting for DRAINED, or null. */
+    struct semaphore drained;   /* Upped by the last reader out. */
+#ifdef THREADS
+    struct list holders;        /* Readers, as struct rwlock_hold. */
+#endif
+  };
+
+#ifdef THREADS
+/* A thread's hold on a readers-writer lock for reading, through
+   which a writer waiting for the readers donates its priority to
+   them.  A thread may hold up to RWLOCK_HOLD_MAX such locks at
+   once. */
+#define RWLOCK_HOLD_MAX 4
+struct rwlock_hold
+  {
+    struct rwlock *rwlock;      /* Lock held, or null if unused. */
+    struct thread *thread;      /* Holding thread. */
+    struct list_elem elem;      /* Element in the lock's HOLDERS. */
+  };
+
+void rwlock_donate (struct rwlock *);
+#endif
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Condition variable. */
 struct condition 
   {
@@ -490,6 +490,15 @@ thread_pushup_priority (struct thread *cur)
       if (t->priority > cur->priority)
         cur->priority = t->priority;
     }
+
+  /* Writers waiting for readers donate through the readers' holds. */
+  for (int i = 0; i < RWLOCK_HOLD_MAX; i++)
+    {
+      struct rwlock *rwlock = cur->read_holds[i].rwlock;
+      if (rwlock != NULL && rwlock->drainer != NULL
+          && rwlock->drainer->priority > cur->priority)
+        cur->priority = rwlock->drainer->priority;
+    }
 }
 
 /* Forward the priority of the DONOR to the RECIEVER and its upstream locks. */
@@ -498,8 +507,16 @@ thread_forward_priority (struct thread *donor, struct lock *lock)
 {
   struct thread *reciever = lock->holder;     
   thread_donate_priority (donor, reciever);
-  while (reciever->waiting_lock)
+  while (true)
     {
+      // A writer waiting for readers passes the donation on to them
+      if (reciever->draining_rwlock != NULL)
+        {
+          rwlock_donate (reciever->draining_rwlock);
+          break;
+        }
+      if (reciever->waiting_lock == NULL)
+        break;
       donor = reciever;
       reciever = reciever->waiting_lock->holder;
       if (reciever->priority < donor->priority)
@@ -738,8 +755,9 @@ init_thread (struct thread *t, const char *name, int priority, int cwd_fd)
   t->exit_status = -1;   
   t->exec_file = NULL;
 
-  // Initialize the file list and next_fd
-  list_init (&t->file_list);
+  // The fd table is allocated on the first open
+  t->fd_table = NULL;
+  t->fd_cnt = 0;
   t->next_fd = 2; // 0 and 1 are reserved for stdin and stdout
 
   // Initialize the child list
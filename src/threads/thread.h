@@ -8,12 +8,14 @@
 
 #ifdef THREADS
 #include "threads/fixed-point.h"
+#include "threads/synch.h"
 #endif
 
 #include "threads/synch.h"
 
-#ifdef USERPROG
 #define NOT_A_FD -1     /* Not a file descriptor. */
+
+#ifdef USERPROG
 #include "filesys/filesys.h"
 #endif
 
@@ -122,6 +124,8 @@ struct thread
     struct list donor_list;             /* List of donors. */
     struct list_elem donor_elem;        /* List element for donors list. */
     struct lock *waiting_lock;          /* Lock that the thread is waiting on. */        
+    struct rwlock *draining_rwlock;     /* Lock whose readers the thread waits out. */
+    struct rwlock_hold read_holds[RWLOCK_HOLD_MAX]; /* Locks held for reading. */
 
     int nice;                           /* Nice value. */
     f32 recent_cpu;                     /* Recent CPU. */
@@ -136,8 +140,9 @@ struct thread
 
     int exit_status;                    /* Exit status. */
     struct file *exec_file;             /* Executable file. */
-    struct list file_list;              /* List of files. */
-    int next_fd;                        /* Next file descriptor. */
+    struct file **fd_table;             /* Open files, indexed by fd. */
+    int fd_cnt;                         /* Number of slots in fd_table. */
+    int next_fd;                        /* No free fd below this one. */
 
     struct list child_list;             /* List of children. */    
     struct lock child_lock;             /* Child lock. */
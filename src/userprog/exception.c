@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <tanc.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
@@ -172,6 +173,10 @@ page_fault (struct intr_frame *f)
   if (success) return;
 #endif
 
+  /* A bad user address passed to a system call. */
+  if (!user && syscall_handle_fault (f))
+    return;
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
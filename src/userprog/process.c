@@ -32,13 +32,11 @@ static bool load (struct list* arg_list, void (**eip) (void), void **esp);
 static struct list* parse_args(const char* file_name);
 static void cleanup_args(struct list* arg_list);
 
-struct lock fs_lock;
-
-/* Initializes the process system */
+/* Initializes the process system.  Nothing to do: the file system
+   does its own locking. */
 void
 process_init (void) 
 {
-  lock_init(&fs_lock);
 }
 
 struct arg_elem 
@@ -302,13 +300,6 @@ process_wait (tid_t child_tid)
   return exit_status;
 }
 
-struct file_elem
-  {
-    struct file* file;
-    int fd;
-    struct list_elem elem;
-  }; 
-
 static bool 
 process_child_pred (const struct list_elem* e, void* aux)
 {
@@ -388,23 +379,18 @@ process_exit (void)
     }
 
   // Close all open files
-  while (!list_empty (&cur->file_list))
-    {
-      e = list_pop_front (&cur->file_list);
-      struct file_elem* file_elem = list_entry (e, struct file_elem, elem);
-      lock_acquire (&fs_lock);
-      file_close (file_elem->file);
-      lock_release (&fs_lock);
-      free (file_elem);
-    }
+  for (int fd = 0; fd < cur->fd_cnt; fd++)
+    if (cur->fd_table[fd] != NULL)
+      file_close (cur->fd_table[fd]);
+  free (cur->fd_table);
+  cur->fd_table = NULL;
+  cur->fd_cnt = 0;
 
   // Close the executable file
   if (cur->exec_file != NULL)
     {
-      lock_acquire (&fs_lock);
       file_allow_write (cur->exec_file);
       file_close (cur->exec_file);
-      lock_release (&fs_lock);
     }    
 }
 
@@ -424,58 +410,69 @@ process_activate (void)
   tss_update ();
 } 
 
-static bool process_file_pred (const struct list_elem *e, void *aux);
+/* Initial number of slots in a process's fd table; it doubles
+   each time it fills up. */
+#define FD_TABLE_MIN 16
 
+/* Adds F to the current process's open files and returns its fd,
+   the lowest one free, or -1 if F is null or memory is short. */
 int 
 process_add_file (struct file *f)
 {
   struct thread* cur = thread_current ();
-  struct file_elem* fe = malloc (sizeof (struct file_elem));
-  if (fe == NULL)
+  int fd;
+
+  if (f == NULL)
     return -1;
-  int fd = (int) inode_get_inumber(file_get_inode(f));
-  while(process_get_file(fd) != NULL)
-    fd += FD_GROW_MAGIC;
-  fe->file = f;
-  fe->fd = fd;
-  list_push_back (&cur->file_list, &fe->elem);
-  return fe->fd;
-}
 
-static bool 
-process_file_pred (const struct list_elem *e, void *aux)
-{
-  struct file_elem* fe = list_entry (e, struct file_elem, elem);
-  return fe->fd == *(int*)aux;
+  // Every fd below next_fd is in use
+  for (fd = cur->next_fd; fd < cur->fd_cnt; fd++)
+    if (cur->fd_table[fd] == NULL)
+      break;
+
+  if (fd == cur->fd_cnt)
+    {
+      int cnt = cur->fd_cnt == 0 ? FD_TABLE_MIN : cur->fd_cnt * 2;
+      struct file **table = realloc (cur->fd_table, cnt * sizeof *table);
+      if (table == NULL)
+        return -1;
+      memset (table + cur->fd_cnt, 0,
+              (cnt - cur->fd_cnt) * sizeof *table);
+      cur->fd_table = table;
+      cur->fd_cnt = cnt;
+    }
+
+  cur->fd_table[fd] = f;
+  cur->next_fd = fd + 1;
+  return fd;
 }
 
+/* Returns the file open as FD in the current process, or a null
+   pointer if there is none. */
 struct file*
 process_get_file (int fd)
 {
-  struct list_elem* e = list_find_if (&thread_current ()->file_list, 
-      process_file_pred, &fd);
-  if (e == NULL)
-    return NULL;
+  struct thread* cur = thread_current ();
 
-  struct file_elem* fe = list_entry (e, struct file_elem, elem);
-  return fe->file;
+  if (fd < 2 || fd >= cur->fd_cnt)
+    return NULL;
+  return cur->fd_table[fd];
 }
 
+/* Closes FD in the current process, if it is open. */
 void
 process_close_file (int fd)
 {
-  struct list_elem* e = list_find_if (&thread_current ()->file_list, 
-      process_file_pred, &fd);
-  if (e == NULL)
+  struct thread* cur = thread_current ();
+  struct file *f = process_get_file (fd);
+
+  if (f == NULL)
     return;
-    
-  struct file_elem* fe = list_entry (e, struct file_elem, elem);
 
-  lock_acquire (&fs_lock);
-  file_close (fe->file);
-  lock_release (&fs_lock);
-  list_remove (&fe->elem);
-  free (fe);
+  file_close (f);
+  cur->fd_table[fd] = NULL;
+  if (fd < cur->next_fd)
+    cur->next_fd = fd;
 }
 
 static bool load_segment (
@@ -646,7 +643,6 @@ load (struct list* arg_list, void (**eip) (void), void **esp)
       list_front(arg_list), struct arg_elem, elem)->arg;
 
   /* Open executable file. */
-  lock_acquire(&fs_lock);
   file = filesys_open (exec_name, ROOT_DIR_FD);
   if (file == NULL) 
     {
@@ -747,7 +743,6 @@ load (struct list* arg_list, void (**eip) (void), void **esp)
   /* We arrive here whether the load is successful or not. */
   if (!success) 
     file_close (file);
-  lock_release(&fs_lock);
   return success;
 }
 
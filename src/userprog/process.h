@@ -4,8 +4,6 @@
 #include "threads/synch.h"
 #include "threads/thread.h"
 
-extern struct lock fs_lock;
-
 void process_init (void);
 tid_t process_execute (const char *file_name,int cwd_fd);
 int process_wait (tid_t);
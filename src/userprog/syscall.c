@@ -8,18 +8,24 @@
 #include "stdbool.h"
 #include "stddef.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <syscall-types.h>
 #include <tanc.h>
 #ifdef VM
 #include "vm/page.h"
 #endif
 
 static void syscall_handler (struct intr_frame *);
+static uint32_t syscall_dispatch (int sys_code,
+                                  const int args[SYSCALL_MAX_ARGS]);
 
 static void syscall_halt (void);
 static void syscall_exit (int status);
@@ -39,6 +45,13 @@ static bool syscall_mkdir (const char *dir);
 static bool syscall_readdir (int fd, char *name);
 static bool syscall_isdir (int fd);
 static int syscall_inumber (int fd);
+static int syscall_pread (int fd, void *buffer, unsigned size,
+                          unsigned position);
+static int syscall_pwrite (int fd, const void *buffer, unsigned size,
+                           unsigned position);
+static int syscall_readv (int fd, const struct iovec *iov, int iovcnt);
+static int syscall_writev (int fd, const struct iovec *iov, int iovcnt);
+static int syscall_submit (struct syscall_ring *ring);
 
 #ifdef VM
 static int syscall_mmap (int fd, void *addr);
@@ -48,7 +61,11 @@ static void syscall_munmap (int mapid);
 static bool is_valid_vaddr (const void *vaddr, bool write);
 static bool is_valid_vrange (const void *vaddr, unsigned size, bool write);
 static bool is_valid_word (const void *vaddr, bool write);
-static bool is_valid_string (const char *str, bool write);
+static char *copy_in_string (const char *ustr);
+static bool copy_out (void *udst, const void *src, size_t size);
+static bool is_valid_iovec (const struct iovec *iov, int iovcnt);
+static void pin_buffer (const void *buffer, unsigned size, bool write);
+static void unpin_buffer (const void *buffer, unsigned size);
 
 void
 syscall_init (void)
@@ -56,133 +73,116 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Number of argument words each system call takes. */
+static const uint8_t syscall_argc[] =
+  {
+    [SYS_HALT] = 0, [SYS_EXIT] = 1, [SYS_EXEC] = 1, [SYS_WAIT] = 1,
+    [SYS_CREATE] = 2, [SYS_REMOVE] = 1, [SYS_OPEN] = 1,
+    [SYS_FILESIZE] = 1, [SYS_READ] = 3, [SYS_WRITE] = 3, [SYS_SEEK] = 2,
+    [SYS_TELL] = 1, [SYS_CLOSE] = 1, [SYS_MMAP] = 2, [SYS_MUNMAP] = 1,
+    [SYS_CHDIR] = 1, [SYS_MKDIR] = 1, [SYS_READDIR] = 2, [SYS_ISDIR] = 1,
+    [SYS_INUMBER] = 1, [SYS_PREAD] = 4, [SYS_PWRITE] = 4, [SYS_READV] = 3,
+    [SYS_WRITEV] = 3, [SYS_SUBMIT] = 1,
+  };
+
 static void
 syscall_handler (struct intr_frame *f)
 {
+  int args[SYSCALL_MAX_ARGS];
+
   if (!is_valid_word (f->esp, false))
     {
       syscall_exit (-1);
     }
 
   int sys_code = *(int *)f->esp;
+  if (sys_code < 0 || sys_code >= (int) (sizeof syscall_argc))
+    syscall_exit (-1);
 
+  /* Check all the arguments at once, then copy them. */
+  size_t argc = syscall_argc[sys_code];
+  if (argc > 0 && !is_valid_vrange (f->esp + 4, argc * sizeof (int), false))
+    syscall_exit (-1);
+  memcpy (args, f->esp + 4, argc * sizeof (int));
+
+  f->eax = syscall_dispatch (sys_code, args);
+}
+
+/* Carries out system call SYS_CODE with arguments ARGS and returns
+   its result, 0 for system calls without one.  Shared by the
+   int $0x30 handler and syscall_submit(). */
+static uint32_t
+syscall_dispatch (int sys_code, const int args[SYSCALL_MAX_ARGS])
+{
   switch (sys_code)
     {
     case SYS_HALT:
       syscall_halt ();
       break;
     case SYS_EXIT:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      syscall_exit (*(int *)(f->esp + 4));
+      syscall_exit (args[0]);
       break;
     case SYS_EXEC:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_exec (*(char **)(f->esp + 4));
-      break;
+      return syscall_exec ((const char *) args[0]);
     case SYS_WAIT:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_wait (*(tid_t *)(f->esp + 4));
-      break;
+      return syscall_wait ((tid_t) args[0]);
     case SYS_CREATE:
-      if (!is_valid_word (f->esp + 4, false)
-          || !is_valid_word (f->esp + 8, false))
-        syscall_exit (-1);
-      f->eax = syscall_create (*(char **)(f->esp + 4), *(off_t *)(f->esp + 8));
-      break;
+      return syscall_create ((const char *) args[0], (off_t) args[1]);
     case SYS_REMOVE:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_remove (*(char **)(f->esp + 4));
-      break;
+      return syscall_remove ((const char *) args[0]);
     case SYS_OPEN:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_open (*(char **)(f->esp + 4));
-      break;
+      return syscall_open ((const char *) args[0]);
     case SYS_FILESIZE:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_filesize (*(int *)(f->esp + 4));
-      break;
+      return syscall_filesize (args[0]);
     case SYS_READ:
-      if (!is_valid_word (f->esp + 4, false)
-          || !is_valid_word (f->esp + 8, false)
-          || !is_valid_word (f->esp + 12, false))
-        syscall_exit (-1);
-      f->eax = syscall_read (*(int *)(f->esp + 4), *(void **)(f->esp + 8),
-                             *(unsigned *)(f->esp + 12));
-      break;
+      return syscall_read (args[0], (void *) args[1], (unsigned) args[2]);
     case SYS_WRITE:
-      if (!is_valid_word (f->esp + 4, false)
-          || !is_valid_word (f->esp + 8, false)
-          || !is_valid_word (f->esp + 12, false))
-        syscall_exit (-1);
-      f->eax = syscall_write (*(int *)(f->esp + 4), *(void **)(f->esp + 8),
-                              *(unsigned *)(f->esp + 12));
-      break;
+      return syscall_write (args[0], (const void *) args[1],
+                            (unsigned) args[2]);
     case SYS_SEEK:
-      if (!is_valid_word (f->esp + 4, false)
-          || !is_valid_word (f->esp + 8, false))
-        syscall_exit (-1);
-      syscall_seek (*(int *)(f->esp + 4), *(unsigned *)(f->esp + 8));
+      syscall_seek (args[0], (unsigned) args[1]);
       break;
     case SYS_TELL:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_tell (*(int *)(f->esp + 4));
-      break;
+      return syscall_tell (args[0]);
     case SYS_CLOSE:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      syscall_close (*(int *)(f->esp + 4));
+      syscall_close (args[0]);
       break;
 #ifdef VM
     case SYS_MMAP:
-      if (!is_valid_word (f->esp + 4, false)
-          || !is_valid_word (f->esp + 8, false))
-        syscall_exit (-1);
-      f->eax = syscall_mmap (*(int *)(f->esp + 4), *(void **)(f->esp + 8));
-      break;
+      return syscall_mmap (args[0], (void *) args[1]);
     case SYS_MUNMAP:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      syscall_munmap (*(int *)(f->esp + 4));
+      syscall_munmap (args[0]);
       break;
 #endif
     case SYS_CHDIR:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_chdir (*(char **)(f->esp + 4));
-      break;
+      return syscall_chdir ((const char *) args[0]);
     case SYS_MKDIR:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_mkdir (*(char **)(f->esp + 4));
-      break;
+      return syscall_mkdir ((const char *) args[0]);
     case SYS_READDIR:
-      if (!is_valid_word (f->esp + 4, false)
-          || !is_valid_word (f->esp + 8, false))
-        syscall_exit (-1);
-      f->eax = syscall_readdir (*(int *)(f->esp + 4), *(char **)(f->esp + 8));
-      break;
+      return syscall_readdir (args[0], (char *) args[1]);
     case SYS_INUMBER:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_inumber (*(int *)(f->esp + 4));
-      break;
+      return syscall_inumber (args[0]);
     case SYS_ISDIR:
-      if (!is_valid_word (f->esp + 4, false))
-        syscall_exit (-1);
-      f->eax = syscall_isdir (*(int *)(f->esp + 4));
-      break;
-
+      return syscall_isdir (args[0]);
+    case SYS_PREAD:
+      return syscall_pread (args[0], (void *) args[1], (unsigned) args[2],
+                            (unsigned) args[3]);
+    case SYS_PWRITE:
+      return syscall_pwrite (args[0], (const void *) args[1],
+                             (unsigned) args[2], (unsigned) args[3]);
+    case SYS_READV:
+      return syscall_readv (args[0], (const struct iovec *) args[1],
+                            args[2]);
+    case SYS_WRITEV:
+      return syscall_writev (args[0], (const struct iovec *) args[1],
+                             args[2]);
+    case SYS_SUBMIT:
+      return syscall_submit ((struct syscall_ring *) args[0]);
 
     default:
       syscall_exit (-1);
     }
+  return 0;
 }
 
 static void
@@ -199,11 +199,14 @@ syscall_exit (int status)
 }
 
 static tid_t
-syscall_exec (const char *cmd_line)
+syscall_exec (const char *cmd_line_)
 {
-  if (!is_valid_string (cmd_line, false))
-    syscall_exit (-1);
-  return process_execute (cmd_line, thread_current ()->cwd_fd);
+  char *cmd_line = copy_in_string (cmd_line_);
+  if (cmd_line == NULL)
+    return TID_ERROR;
+  tid_t tid = process_execute (cmd_line, thread_current ()->cwd_fd);
+  palloc_free_page (cmd_line);
+  return tid;
 }
 
 static int
@@ -213,60 +216,51 @@ syscall_wait (tid_t pid)
 }
 
 static bool
-syscall_create (const char *file, off_t initial_size)
+syscall_create (const char *file_, off_t initial_size)
 {
-  if (!is_valid_string (file, false))
-    syscall_exit (-1);
-  lock_acquire (&fs_lock);
+  char *file = copy_in_string (file_);
+  if (file == NULL)
+    return false;
   bool success
       = filesys_create (file, initial_size, thread_current ()->cwd_fd, false);
-  int parent_fd = NOT_A_FD;
-  path_seek (file, thread_current ()->cwd_fd, &parent_fd);
-  lock_release (&fs_lock);
+  palloc_free_page (file);
   return success;
 }
 
 static bool
-syscall_remove (const char *fileOrDir)
+syscall_remove (const char *fileOrDir_)
 {
-  if (!is_valid_string (fileOrDir, false))
-    syscall_exit (-1);
-  lock_acquire (&fs_lock);
+  char *fileOrDir = copy_in_string (fileOrDir_);
+  if (fileOrDir == NULL)
+    return false;
   bool success = filesys_remove (fileOrDir, thread_current ()->cwd_fd);
-  lock_release (&fs_lock);
+  palloc_free_page (fileOrDir);
   return success;
 }
 
 static int
-syscall_open (const char *file)
+syscall_open (const char *file_)
 {
-  if (!is_valid_string (file, false))
-    syscall_exit (-1);
+  char *file = copy_in_string (file_);
+  if (file == NULL)
+    return -1;
 
-  lock_acquire (&fs_lock);
   // struct file *f = filesys_open(file,thread_current()->cwd_fd);
   int parent_fd = NOT_A_FD;
   struct inode *inode
       = path_seek (file, thread_current ()->cwd_fd, &parent_fd);
-  lock_release (&fs_lock);
+  palloc_free_page (file);
   if (inode == NULL)
     {
       return -1;
     }
 
 
-  if (inode_is_dir (inode))
-    {
-      struct file *file = file_open (inode);
-      return process_add_file (file);
-    }
-  if (inode_is_file (inode))
-    {
-      struct file *file = file_open (inode);
-      return process_add_file (file);
-    }
-  /* other undefined cases? */
-  return -1;
+  struct file *f = file_open (inode);
+  int fd = process_add_file (f);
+  if (fd == -1)
+    file_close (f);
+  return fd;
 }
 
 static int
@@ -277,9 +271,7 @@ syscall_filesize (int fd)
     {
       syscall_exit (-1);
     }
-  lock_acquire (&fs_lock);
   int size = file_length (f);
-  lock_release (&fs_lock);
   return size;
 }
 
@@ -306,9 +298,9 @@ syscall_read (int fd, void *buffer, unsigned size)
   if (f == NULL || file_is_dir (f))
     syscall_exit (-1);
 
-  lock_acquire (&fs_lock);
+  pin_buffer (buffer, size, true);
   int bytes_read = file_read (f, buffer, (off_t)size);
-  lock_release (&fs_lock);
+  unpin_buffer (buffer, size);
   return bytes_read;
 }
 
@@ -331,9 +323,9 @@ syscall_write (int fd, const void *buffer, unsigned size)
   if (f == NULL || file_is_dir (f))
     syscall_exit (-1);
 
-  lock_acquire (&fs_lock);
+  pin_buffer (buffer, size, false);
   int bytes_written = file_write (f, buffer, (off_t)size);
-  lock_release (&fs_lock);
+  unpin_buffer (buffer, size);
   return bytes_written;
 }
 
@@ -343,9 +335,7 @@ syscall_seek (int fd, unsigned position)
   struct file *f = process_get_file (fd);
   if (f == NULL)
     syscall_exit (-1);
-  lock_acquire (&fs_lock);
   file_seek (f, (off_t)position);
-  lock_release (&fs_lock);
 }
 
 static unsigned
@@ -354,9 +344,7 @@ syscall_tell (int fd)
   struct file *f = process_get_file (fd);
   if (f == NULL)
     syscall_exit (-1);
-  lock_acquire (&fs_lock);
   unsigned position = file_tell (f);
-  lock_release (&fs_lock);
   return position;
 }
 
@@ -381,9 +369,7 @@ syscall_mmap (int fd, void *addr)
   if (f == NULL)
     return MAPID_ERROR;
 
-  lock_acquire (&fs_lock);
   f = file_reopen (f);
-  lock_release (&fs_lock);
   if (f == NULL)
     return MAPID_ERROR;
 
@@ -425,8 +411,34 @@ is_valid_vaddr (const void *vaddr, bool write UNUSED)
 #endif
 }
 
+/* Brings the user pages of the SIZE bytes at BUFFER, already
+   validated, into memory and pins them there until unpin_buffer().
+   The file system copies to and from user buffers while it holds
+   inode and buffer cache locks, and a fault taken then could need
+   the same locks to bring the page in from a file.  Without VM user
+   pages never fault, so there is nothing to do. */
+static void
+pin_buffer (const void *buffer UNUSED, unsigned size UNUSED,
+            bool write UNUSED)
+{
+#ifdef VM
+  if (!page_pin_range (&thread_current ()->sup_page_table, buffer, size,
+                       write))
+    syscall_exit (-1);
+#endif
+}
+
+/* Unpins the pages pinned by pin_buffer(). */
+static void
+unpin_buffer (const void *buffer UNUSED, unsigned size UNUSED)
+{
+#ifdef VM
+  page_unpin_range (&thread_current ()->sup_page_table, buffer, size);
+#endif
+}
+
 /* Returns true if the given virtual address range is valid,
-   false otherwise. */
+   false otherwise.  Checks every page of the range, once. */
 static bool
 is_valid_vrange (const void *vaddr, unsigned size, bool write)
 {
@@ -435,7 +447,15 @@ is_valid_vrange (const void *vaddr, unsigned size, bool write)
     {
       return false;
     }
-  return is_valid_vaddr (vaddr, write) && is_valid_vaddr (end, write);
+  for (const void *page = pg_round_down (vaddr); page <= end;
+       page += PGSIZE)
+    {
+      if (!is_valid_vaddr (page < vaddr ? vaddr : page, write))
+        return false;
+      if (page + PGSIZE < page)
+        break;
+    }
+  return true;
 }
 
 static bool
@@ -444,28 +464,112 @@ is_valid_word (const void *vaddr, bool write)
   return is_valid_vrange (vaddr, sizeof (int), write);
 }
 
-/* Returns true if the given string is valid, false
-   otherwise. */
-static bool
-is_valid_string (const char *str, bool write)
+/* Accessors for user memory that let the page fault handler,
+   rather than a lookup per access, catch bad addresses: each
+   loads the address to resume at into EAX before the access that
+   may fault, and if it does, syscall_handle_fault() makes it
+   resume there with EAX set to -1.  Only the two instructions at
+   GET_USER_FAULT and PUT_USER_FAULT are recovered this way. */
+extern const char get_user_fault[], put_user_fault[];
+
+/* Reads a byte at user virtual address UADDR, which must be
+   below PHYS_BASE.  Returns the byte value if successful, -1 if
+   a page fault occurred. */
+static int NO_INLINE
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm volatile ("movl $1f, %0\n"
+                "get_user_fault:\n\t"
+                "movzbl %1, %0\n"
+                "1:"
+                : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a page fault
+   occurred. */
+static bool NO_INLINE
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm volatile ("movl $1f, %0\n"
+                "put_user_fault:\n\t"
+                "movb %b2, %1\n"
+                "1:"
+                : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* If F is a page fault taken by the kernel in get_user() or
+   put_user(), arranges for the accessor to return failure and
+   returns true.  Returns false for any other fault. */
+bool
+syscall_handle_fault (struct intr_frame *f)
+{
+  const char *eip = (const char *) f->eip;
+
+  if (eip != get_user_fault && eip != put_user_fault)
+    return false;
+  f->eip = (void (*) (void)) f->eax;
+  f->eax = 0xffffffff;
+  return true;
+}
+
+/* Copies the null-terminated string at user address USTR into a
+   new page and returns it, for the caller to free with
+   palloc_free_page().  The string is read a byte at a time, with
+   no page table lookups.  Kills the process if USTR is not a
+   valid user string.  Returns a null pointer if the string does
+   not fit in a page or no page is free. */
+static char *
+copy_in_string (const char *ustr)
 {
-  while (is_valid_vaddr (str, write))
+  char *kstr = palloc_get_page (0);
+  if (kstr == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < PGSIZE; i++)
     {
-      if (*str == '\0')
+      const uint8_t *uaddr = (const uint8_t *) ustr + i;
+      int c = is_user_vaddr (uaddr) ? get_user (uaddr) : -1;
+      if (c == -1)
         {
-          return true;
+          palloc_free_page (kstr);
+          syscall_exit (-1);
         }
-      str++;
+      kstr[i] = c;
+      if (c == '\0')
+        return kstr;
     }
-  return false;
+  palloc_free_page (kstr);
+  return NULL;
 }
 
+/* Copies SIZE bytes from kernel address SRC to user address UDST.
+   Returns true if successful, false if UDST is not valid user
+   memory. */
 static bool
-syscall_chdir (const char *dir)
+copy_out (void *udst_, const void *src_, size_t size)
 {
-  lock_acquire(&fs_lock);
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+
+  for (size_t i = 0; i < size; i++)
+    if (!is_user_vaddr (udst + i) || !put_user (udst + i, src[i]))
+      return false;
+  return true;
+}
+
+static bool
+syscall_chdir (const char *dir_)
+{
+  char *dir = copy_in_string (dir_);
+  if (dir == NULL)
+    return false;
   struct inode *inode = path_seek (dir, thread_current ()->cwd_fd, NULL);
-  lock_release(&fs_lock);
+  palloc_free_page (dir);
   if (inode == NULL)
     return false;
   if (!inode_is_dir (inode))
@@ -480,11 +584,13 @@ syscall_chdir (const char *dir)
 }
 
 static bool
-syscall_mkdir (const char *dir)
+syscall_mkdir (const char *dir_)
 {
-  lock_acquire (&fs_lock);
+  char *dir = copy_in_string (dir_);
+  if (dir == NULL)
+    return false;
   bool success = filesys_create (dir, 0, thread_current ()->cwd_fd, true);
-  lock_release (&fs_lock);
+  palloc_free_page (dir);
   return success;
 }
 
@@ -502,9 +608,10 @@ syscall_readdir (int fd, char *name)
   if (dir == NULL){
     return false;
   }
-  lock_acquire(&fs_lock);
-  bool success = dir_readdir (dir, name); //TODO where is name allocated?
-  lock_release(&fs_lock);
+  char kname[NAME_MAX + 1];
+  bool success = dir_readdir (dir, kname);
+  if (success && !copy_out (name, kname, strlen (kname) + 1))
+    syscall_exit (-1);
   return success;
 }
 static bool
@@ -522,5 +629,171 @@ syscall_isdir (int fd)
 static int
 syscall_inumber (int fd)
 {
-  return fd % FD_GROW_MAGIC;
-}
\ No newline at end of file
+  struct file *f = process_get_file (fd);
+  if (f == NULL)
+    return -1;
+  return inode_get_inumber (file_get_inode (f));
+}
+
+/* Reads SIZE bytes from file FD at POSITION into BUFFER, without
+   using or moving the file position.  The console has no position,
+   so fails on it, as on directories. */
+static int
+syscall_pread (int fd, void *buffer, unsigned size, unsigned position)
+{
+  if (size == 0)
+    return 0;
+
+  if (!is_valid_vrange (buffer, size, true))
+    syscall_exit (-1);
+
+  if (fd == STDIN_FILENO || fd == STDOUT_FILENO || (off_t) position < 0)
+    return -1;
+
+  struct file *f = process_get_file (fd);
+  if (f == NULL || file_is_dir (f))
+    syscall_exit (-1);
+
+  pin_buffer (buffer, size, true);
+  int bytes_read = file_read_at (f, buffer, (off_t)size, (off_t)position);
+  unpin_buffer (buffer, size);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER to file FD at POSITION, without
+   using or moving the file position. */
+static int
+syscall_pwrite (int fd, const void *buffer, unsigned size, unsigned position)
+{
+  if (size == 0)
+    return 0;
+
+  if (!is_valid_vrange (buffer, size, false))
+    syscall_exit (-1);
+
+  if (fd == STDIN_FILENO || fd == STDOUT_FILENO || (off_t) position < 0)
+    return -1;
+
+  struct file *f = process_get_file (fd);
+  if (f == NULL || file_is_dir (f))
+    syscall_exit (-1);
+
+  pin_buffer (buffer, size, false);
+  int bytes_written = file_write_at (f, buffer, (off_t)size,
+                                     (off_t)position);
+  unpin_buffer (buffer, size);
+  return bytes_written;
+}
+
+/* Returns true if IOV, an array of IOVCNT user buffers, is not too
+   long and its lengths add up to at most INT_MAX, so that the total
+   transferred fits the return value.  Kills the process if the
+   array itself cannot be read, as for any other bad pointer. */
+static bool
+is_valid_iovec (const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX)
+    return false;
+  if (iovcnt > 0 && !is_valid_vrange (iov, iovcnt * sizeof *iov, false))
+    syscall_exit (-1);
+  for (int i = 0; i < iovcnt; i++)
+    {
+      if (iov[i].iov_len > INT_MAX - total)
+        return false;
+      total += iov[i].iov_len;
+    }
+  return true;
+}
+
+/* Reads from FD into each of the IOVCNT buffers in IOV in turn, as
+   one read() would into their concatenation, and returns the total
+   number of bytes read.  Stops at the first short read. */
+static int
+syscall_readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  int total = 0;
+
+  if (!is_valid_iovec (iov, iovcnt))
+    return -1;
+  for (int i = 0; i < iovcnt; i++)
+    {
+      int bytes_read = syscall_read (fd, iov[i].iov_base, iov[i].iov_len);
+      if (bytes_read < 0)
+        return total > 0 ? total : bytes_read;
+      total += bytes_read;
+      if ((size_t) bytes_read < iov[i].iov_len)
+        break;
+    }
+  return total;
+}
+
+/* Writes each of the IOVCNT buffers in IOV to FD in turn, as one
+   write() would their concatenation, and returns the total number
+   of bytes written.  Stops at the first short write. */
+static int
+syscall_writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  int total = 0;
+
+  if (!is_valid_iovec (iov, iovcnt))
+    return -1;
+  for (int i = 0; i < iovcnt; i++)
+    {
+      int bytes_written = syscall_write (fd, iov[i].iov_base,
+                                         iov[i].iov_len);
+      if (bytes_written < 0)
+        return total > 0 ? total : bytes_written;
+      total += bytes_written;
+      if ((size_t) bytes_written < iov[i].iov_len)
+        break;
+    }
+  return total;
+}
+
+/* Carries out the system calls queued in RING, from its head up
+   to the tail it had on entry, as if each had been made with its
+   own trap, and returns how many were.  A program can so make
+   many small calls for the price of one trap.  SYS_SUBMIT itself
+   cannot be queued; it fails with -1.  The ring is checked again
+   before each entry, since a call may unmap it. */
+static int
+syscall_submit (struct syscall_ring *ring)
+{
+  int args[SYSCALL_MAX_ARGS];
+  unsigned size, tail;
+  int done = 0;
+
+  if (!is_valid_vrange (ring, sizeof *ring, true))
+    syscall_exit (-1);
+  size = ring->size;
+  tail = ring->tail;
+  if (size == 0 || size > SYSCALL_RING_MAX || (size & (size - 1)) != 0)
+    return -1;
+
+  while ((unsigned) done < size)
+    {
+      if (!is_valid_vrange (ring, sizeof *ring, true))
+        syscall_exit (-1);
+      if (ring->head == tail)
+        break;
+
+      struct syscall_req *req = &ring->entries[ring->head & (size - 1)];
+      if (!is_valid_vrange (req, sizeof *req, true))
+        syscall_exit (-1);
+      int sys_code = req->nr;
+      memcpy (args, req->args, sizeof args);
+
+      uint32_t result = sys_code == SYS_SUBMIT
+                        ? (uint32_t) -1 : syscall_dispatch (sys_code, args);
+
+      if (!is_valid_vrange (ring, sizeof *ring, true)
+          || !is_valid_vrange (req, sizeof *req, true))
+        syscall_exit (-1);
+      req->result = result;
+      ring->head++;
+      done++;
+    }
+  return done;
+}
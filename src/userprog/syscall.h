@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+
+struct intr_frame;
+
 void syscall_init (void);
+bool syscall_handle_fault (struct intr_frame *);
 
 #endif /* userprog/syscall.h */
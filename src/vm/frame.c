@@ -1,27 +1,87 @@
 #include "vm/frame.h"
 #include <debug.h>
-#include <list.h>
+#include <round.h>
 #include <tanc.h>
+#include "filesys/cache.h"
+#include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "vm/swap.h"
 
-static struct list frame_table;
+/* Frame table, indexed by physical frame number.  A null slot is
+   a frame not in use by a user page.  CLOCK_HAND is the slot the
+   clock looks at next; it keeps its place between evictions, so
+   each frame is passed over once per sweep no matter where it
+   sits in memory.  All three are protected by FRAME_TABLE_LOCK. */
+static struct frame_table_entry **frame_table;
+static size_t frame_cnt;
+static size_t clock_hand;
 static struct lock frame_table_lock;
 
-static void frame_evict (void);
+/* Upper bound on a frame's age.  Each clock pass over a frame that
+   was accessed since the last one makes it one older, up to this
+   limit, and each pass over one that was not makes it one younger;
+   a frame is evicted when the hand finds it at age 0.  Frames in
+   steady use thus survive several sweeps after they go idle, which
+   approximates LRU without keeping the frames in order. */
+#define FRAME_AGE_MAX 3
+
+/* Once the hand has found an old frame that would have to be
+   written out, it looks at up to this many more frames for an old
+   clean one, which can simply be dropped, before settling for it. */
+#define FRAME_CLEAN_SEARCH 16
+
+/* Page-out daemon.  When an allocation leaves fewer than
+   FRAME_LOW_WATER user frames free, it is woken through PAGEOUT_COND
+   and evicts pages, writing the dirty ones out, until
+   FRAME_HIGH_WATER frames are free again.  Faults thus usually find
+   a free frame waiting instead of paying for an eviction.  The
+   watermarks are fractions of the user pool, set at start-up. */
+#define FRAME_WATER_DIV 32
+static size_t frame_low_water, frame_high_water;
+static struct condition pageout_cond;
+
+static bool frame_evict (void);
 static struct frame_table_entry* frame_find_victim (void);
+static bool frame_is_clean (struct frame_table_entry *fte);
+static void frame_pageout_daemon (void *aux);
 
 void 
 frame_table_init (void) {
-  list_init (&frame_table);
+  frame_cnt = init_ram_pages;
+  frame_table = calloc (frame_cnt, sizeof *frame_table);
+  if (frame_table == NULL)
+    PANIC ("frame table creation failed");
+  clock_hand = 0;
   lock_init (&frame_table_lock);
+
+  frame_low_water = DIV_ROUND_UP (palloc_free_cnt (PAL_USER),
+                                  FRAME_WATER_DIV);
+  frame_high_water = 2 * frame_low_water;
+  cond_init (&pageout_cond);
+  thread_create ("frame_pageout_daemon", PRI_DEFAULT,
+      frame_pageout_daemon, NULL, NOT_A_FD);
+}
+
+/* Returns the frame table slot for kernel page FRAME. */
+static size_t
+frame_index (const void *frame)
+{
+  size_t idx = pg_no ((void *) vtop (frame));
+  ASSERT (idx < frame_cnt);
+  return idx;
 }
 
+/* Allocates a frame for PAGE_ENTRY and maps it at USER_VADDR in the
+   current process.  The frame is returned pinned, so that it is not
+   chosen for eviction before the caller has filled it; the caller
+   must frame_unpin() it once the page is loaded.  Returns a null
+   pointer if no frame could be obtained. */
 struct frame_table_entry*
 frame_alloc (struct sup_page_table_entry *page_entry, 
     uint32_t* user_vaddr, bool writable) 
@@ -35,15 +95,22 @@ frame_alloc (struct sup_page_table_entry *page_entry,
     }
 
   fte->frame = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (fte->frame == NULL) 
+  if (fte->frame == NULL && cache_shrink ())
+    fte->frame = palloc_get_page (PAL_USER | PAL_ZERO);
+  while (fte->frame == NULL) 
     {
-      frame_evict ();
+      if (!frame_evict ())
+        {
+          free (fte);
+          return NULL;
+        }
       fte->frame = palloc_get_page (PAL_USER | PAL_ZERO);
-      ASSERT (fte->frame != NULL);
     }
 
   fte->owner = thread_current ();
   fte->page_entry = page_entry;
+  fte->pinned = true;
+  fte->age = 1;
 
   if (!install_page (user_vaddr, fte->frame, writable)) 
     {
@@ -53,7 +120,9 @@ frame_alloc (struct sup_page_table_entry *page_entry,
     }
 
   lock_acquire (&frame_table_lock);
-  list_push_back (&frame_table, &fte->elem);
+  frame_table[frame_index (fte->frame)] = fte;
+  if (palloc_free_cnt (PAL_USER) < frame_low_water)
+    cond_signal (&pageout_cond, &frame_table_lock);
   lock_release (&frame_table_lock);
 
   return fte;
@@ -67,21 +136,54 @@ frame_free (struct frame_table_entry *fte)
   pagedir_clear_page (fte->owner->pagedir, fte->page_entry->user_vaddr);
 
   lock_acquire (&frame_table_lock);
-  list_remove (&fte->elem);
+  frame_table[frame_index (fte->frame)] = NULL;
   lock_release (&frame_table_lock);
 
   palloc_free_page (fte->frame);
   free (fte);
 }
 
-static void
+/* Pins FTE, so that it is not chosen for eviction.  Returns false
+   if it is already pinned, which for a frame whose page's lock the
+   caller holds means that it is on its way out. */
+bool
+frame_pin (struct frame_table_entry *fte)
+{
+  bool success;
+
+  ASSERT (fte != NULL);
+
+  lock_acquire (&frame_table_lock);
+  success = !fte->pinned;
+  fte->pinned = true;
+  lock_release (&frame_table_lock);
+  return success;
+}
+
+/* Makes FTE, returned pinned by frame_alloc() or pinned by
+   frame_pin(), eligible for eviction. */
+void
+frame_unpin (struct frame_table_entry *fte)
+{
+  ASSERT (fte != NULL);
+
+  lock_acquire (&frame_table_lock);
+  fte->pinned = false;
+  lock_release (&frame_table_lock);
+}
+
+/* Evicts one user page, freeing its frame.  Returns false if every
+   frame is pinned. */
+static bool
 frame_evict (void) 
 {
   struct frame_table_entry *fte = frame_find_victim ();
-  ASSERT (fte != NULL);
+  if (fte == NULL)
+    return false;
   ASSERT (fte->page_entry != NULL);
-  ASSERT (fte->page_entry->location == PAGE_LOC_MEMORY);
 
+  /* The frame is pinned, so its page cannot be destroyed or leave
+     the frame until we have evicted it; page_destroy() waits. */
   struct sup_page_table_entry *page_entry = fte->page_entry;
 
   if (page_entry->location == PAGE_LOC_MEMORY)
@@ -90,31 +192,106 @@ frame_evict (void)
     page_unmap(page_entry);
   else
     NOT_REACHED ();
+  return true;
 }
 
+/* Advances the clock hand to the next frame to evict and returns
+   it, pinned so that no other eviction picks it as well.  Returns a
+   null pointer if every frame is pinned.  Each step ages the frame
+   under the hand by its accessed bit, as described at
+   FRAME_AGE_MAX, so the hand stops after at most FRAME_AGE_MAX + 1
+   sweeps, and amortized over evictions it takes O(1) steps.  A clean
+   old frame is preferred over a dirty one, as described at
+   FRAME_CLEAN_SEARCH. */
 static struct frame_table_entry*
 frame_find_victim (void) 
 {
-  struct list_elem *e;
-  struct frame_table_entry *fte;
+  struct frame_table_entry *victim = NULL;
+  size_t steps, search = 0;
 
   lock_acquire (&frame_table_lock);
-  // The clock algorithm: https://web.stanford.edu/class/archive/cs/cs111/cs111.1232/lectures/25/Lecture25.pdf
-  for (e = list_begin (&frame_table); e != list_end (&frame_table); 
-      e = list_next (e)) 
+  for (steps = 0; steps < (FRAME_AGE_MAX + 2) * frame_cnt; steps++)
     {
-      fte = list_entry (e, struct frame_table_entry, elem);
-      if (!pagedir_is_accessed (fte->owner->pagedir, fte->page_entry->user_vaddr)) 
+      struct frame_table_entry *fte = frame_table[clock_hand];
+      uint32_t *pd;
+      const void *upage;
+
+      if (victim != NULL && search++ >= FRAME_CLEAN_SEARCH)
+        break;
+      clock_hand = (clock_hand + 1) % frame_cnt;
+      if (fte == NULL || fte->pinned)
+        continue;
+
+      pd = fte->owner->pagedir;
+      upage = fte->page_entry->user_vaddr;
+      if (pagedir_is_accessed (pd, upage))
         {
-          lock_release (&frame_table_lock);
-          return fte;
+          pagedir_set_accessed (pd, upage, false);
+          if (fte->age < FRAME_AGE_MAX)
+            fte->age++;
         }
-      pagedir_set_accessed (fte->owner->pagedir, fte->page_entry->user_vaddr, false);
+      else if (fte->age > 0)
+        fte->age--;
+      else if (frame_is_clean (fte))
+        {
+          victim = fte;
+          break;
+        }
+      else if (victim == NULL)
+        victim = fte;
     }
-
-  e = list_pop_front (&frame_table);
-  fte = list_entry (e, struct frame_table_entry, elem);
+  if (victim != NULL)
+    victim->pinned = true;
   lock_release (&frame_table_lock);
 
-  return fte;
+  return victim;
+}
+
+/* Returns true if unpinned FTE holds a page that page_is_clean().
+   Called with FRAME_TABLE_LOCK held, which page locks come before,
+   so a page whose lock is taken counts as dirty: it is busy, and
+   page_evict() looks at it again under the lock anyway. */
+static bool
+frame_is_clean (struct frame_table_entry *fte)
+{
+  struct lock *lock = fte->page_entry->lock;
+  bool clean;
+
+  ASSERT (lock_held_by_current_thread (&frame_table_lock));
+  ASSERT (!fte->pinned);
+
+  if (!lock_try_acquire (lock))
+    return false;
+  clean = page_is_clean (fte->page_entry);
+  lock_release (lock);
+  return clean;
+}
+
+/* Keeps between FRAME_LOW_WATER and FRAME_HIGH_WATER user frames
+   free, as described there.  If every frame is pinned, waits for
+   the next allocation before trying again. */
+static void
+frame_pageout_daemon (void *aux UNUSED)
+{
+  bool stuck = false;
+
+  lock_acquire (&frame_table_lock);
+  while (true)
+    {
+      while (stuck || palloc_free_cnt (PAL_USER) >= frame_low_water)
+        {
+          cond_wait (&pageout_cond, &frame_table_lock);
+          stuck = false;
+        }
+      lock_release (&frame_table_lock);
+
+      while (palloc_free_cnt (PAL_USER) < frame_high_water)
+        if (!frame_evict ())
+          {
+            stuck = true;
+            break;
+          }
+
+      lock_acquire (&frame_table_lock);
+    }
 }
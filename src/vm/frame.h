@@ -1,7 +1,8 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
-#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "vm/page.h"
 
 struct frame_table_entry {
@@ -9,7 +10,8 @@ struct frame_table_entry {
     struct thread *owner;
     struct sup_page_table_entry *page_entry;
 
-    struct list_elem elem;
+    bool pinned;        /* Skipped by the clock while true. */
+    uint8_t age;        /* Clock passes left before eviction. */
 };
 
 void frame_table_init (void);
@@ -17,6 +19,8 @@ void frame_table_init (void);
 struct frame_table_entry* frame_alloc (struct sup_page_table_entry *page_entry, 
     uint32_t* user_vaddr, bool writable);
 void frame_free (struct frame_table_entry *fte);
+bool frame_pin (struct frame_table_entry *fte);
+void frame_unpin (struct frame_table_entry *fte);
 
 
-#endif // VM_FRAME_H
\ No newline at end of file
+#endif // VM_FRAME_H
@@ -96,12 +96,30 @@ page_create(struct hash* sup_page_table, const void* user_vaddr,
 static struct sup_page_table_entry* page_zero(struct sup_page_table_entry *spte);
 static struct sup_page_table_entry* page_reclaim (struct sup_page_table_entry *spte);
 static struct sup_page_table_entry* page_map (struct sup_page_table_entry *spte);
+static struct sup_page_table_entry* page_load (struct sup_page_table_entry *spte,
+                                               bool write);
+static void page_write_out (struct sup_page_table_entry *spte);
 
 void 
 page_destroy(struct hash* sup_page_table, struct sup_page_table_entry* entry)
 {
   ASSERT(entry != NULL);
 
+  lock_acquire(entry->lock);
+
+  /* The page-out daemon may be evicting the page on behalf of
+     another process.  It pins the frame before it takes the page's
+     lock, so once we hold the lock, either we can pin the frame
+     and keep the daemon away from it, or the daemon has it and we
+     must let it finish and move the page out of the frame. */
+  while ((entry->location == PAGE_LOC_MEMORY
+          || entry->location == PAGE_LOC_MMAPPED)
+         && !frame_pin(entry->frame_entry)) {
+    lock_release(entry->lock);
+    thread_yield();
+    lock_acquire(entry->lock);
+  }
+
   switch (entry->location) {
     case PAGE_LOC_ZERO:
       // Do nothing. The page is all zeros.
@@ -117,11 +135,12 @@ page_destroy(struct hash* sup_page_table, struct sup_page_table_entry* entry)
       frame_free(entry->frame_entry);
       break;
     case PAGE_LOC_MMAPPED:
-      page_unmap(entry);
+      page_write_out(entry);
       break;
     default:
       NOT_REACHED();
   }
+  lock_release(entry->lock);
 
   if (sup_page_table != NULL) hash_delete(sup_page_table, &entry->elem);
   free(entry->lock);
@@ -151,6 +170,7 @@ page_alloc(struct hash* sup_page_table, const void* user_vaddr, bool writable)
 
   entry->dirty = writable;
   entry->accessed = true;
+  frame_unpin(entry->frame_entry);
 
   lock_release(entry->lock);
   return entry;
@@ -232,6 +252,14 @@ page_pull (struct hash* sup_page_table, const void* esp,
       return spte;
     }
 
+  return page_load (spte, write);
+}
+
+/* Brings SPTE into a frame, if it is not in one, for a read or, if
+   WRITE, a write.  Returns SPTE, or a null pointer on failure. */
+static struct sup_page_table_entry*
+page_load (struct sup_page_table_entry *spte, bool write)
+{
   if (write && !spte->writable) return NULL;
 
   spte->dirty = spte->dirty || write;
@@ -272,6 +300,7 @@ page_zero(struct sup_page_table_entry *spte)
 
   spte->frame_entry = fte;
   spte->location = PAGE_LOC_MEMORY;
+  frame_unpin (fte);
 
   lock_release (spte->lock);
   return spte;
@@ -296,6 +325,7 @@ page_reclaim (struct sup_page_table_entry *spte)
   spte->frame_entry = fte;
   spte->location = PAGE_LOC_MEMORY;
   spte->swap_index = BITMAP_ERROR;
+  frame_unpin (fte);
 
   lock_release (spte->lock);
   return spte;
@@ -317,17 +347,14 @@ page_map (struct sup_page_table_entry *spte)
       return NULL;
     }
 
-  lock_acquire (&fs_lock);  
   if (file_read_at (spte->file, fte->frame, (off_t)spte->read_bytes, 
       spte->file_offset) != (int)spte->read_bytes)
     {
       frame_free (fte);
-      lock_release (&fs_lock);
       lock_release (spte->lock);
       return NULL;
     }
   memset (fte->frame + spte->read_bytes, 0, spte->zero_bytes);
-  lock_release (&fs_lock);
 
   spte->frame_entry = fte;
 
@@ -335,6 +362,7 @@ page_map (struct sup_page_table_entry *spte)
     spte->location = PAGE_LOC_MEMORY;
   else
     spte->location = PAGE_LOC_MMAPPED;
+  frame_unpin (fte);
 
   lock_release (spte->lock);
   return spte;
@@ -344,25 +372,37 @@ void
 page_unmap (struct sup_page_table_entry *spte)
 {
   ASSERT (spte != NULL);
-  ASSERT (spte->location == PAGE_LOC_MMAPPED);
 
   lock_acquire (spte->lock);
+  page_write_out (spte);
+  lock_release (spte->lock);
+}
+
+/* Writes mmapped SPTE back to its file if it was written, and frees
+   its frame.  The caller must hold SPTE's lock and have the frame
+   pinned. */
+static void
+page_write_out (struct sup_page_table_entry *spte)
+{
+  ASSERT (spte != NULL);
+  ASSERT (lock_held_by_current_thread (spte->lock));
+  ASSERT (spte->location == PAGE_LOC_MMAPPED);
+
   struct frame_table_entry *fte = spte->frame_entry;
   ASSERT (fte != NULL);
 
+  pagedir_clear_page (fte->owner->pagedir, spte->user_vaddr);
   if (spte->writable && (pagedir_is_dirty (
       fte->owner->pagedir, spte->user_vaddr) || spte->dirty))
     {
-      lock_acquire (&fs_lock);
       file_write_at (spte->file, fte->frame, (off_t)spte->read_bytes, spte->file_offset);
-      lock_release (&fs_lock);
+      spte->dirty = false;
     }
 
   frame_free (fte);
   spte->frame_entry = NULL;
   spte->location = PAGE_LOC_FILESYS;
   spte->accessed = false;
-  lock_release (spte->lock);
 }
 
 void 
@@ -375,11 +415,121 @@ page_evict(struct sup_page_table_entry* spte)
   struct frame_table_entry *fte = spte->frame_entry;
   ASSERT (fte != NULL);
 
-  spte->swap_index = swap_evict ((uint8_t*)fte->frame);
+  /* Unmap the page first, so that it cannot be written between the
+     dirty check and its copy leaving the frame.  The dirty bit
+     survives the unmapping. */
+  pagedir_clear_page (fte->owner->pagedir, spte->user_vaddr);
+  if (page_is_clean (spte))
+    spte->location = PAGE_LOC_EXEC;
+  else
+    {
+      spte->swap_index = swap_evict ((uint8_t*)fte->frame, fte->owner);
+      spte->location = PAGE_LOC_SWAP;
+      spte->file = NULL;
+    }
 
   frame_free (fte);
-  spte->location = PAGE_LOC_SWAP;
   spte->frame_entry = NULL;
   spte->accessed = false;
   lock_release (spte->lock);
-}
\ No newline at end of file
+}
+
+/* Returns true if SPTE, which must be in a frame, can be evicted
+   without writing it anywhere, because it was read from a file and
+   has not been written since.  A page in memory has a file only if
+   it came from the executable; one that goes to swap loses it.
+   The caller must hold SPTE's lock. */
+bool
+page_is_clean (const struct sup_page_table_entry *spte)
+{
+  ASSERT (spte != NULL);
+  ASSERT (lock_held_by_current_thread (spte->lock));
+  ASSERT (spte->frame_entry != NULL);
+
+  return spte->file != NULL && !spte->dirty
+         && !pagedir_is_dirty (spte->frame_entry->owner->pagedir,
+                               spte->user_vaddr);
+}
+
+/* Brings the page at UPAGE into a frame and pins it there.  Returns
+   false if there is no such page or it cannot be brought in. */
+static bool
+page_pin (struct hash *sup_page_table, const void *upage, bool write)
+{
+  struct sup_page_table_entry *spte = page_find (sup_page_table, upage);
+  if (spte == NULL)
+    return false;
+
+  while (true)
+    {
+      bool pinned;
+
+      if (page_load (spte, write) == NULL)
+        return false;
+      lock_acquire (spte->lock);
+      pinned = spte->frame_entry != NULL && frame_pin (spte->frame_entry);
+      lock_release (spte->lock);
+      if (pinned)
+        return true;
+
+      /* Being evicted: let that finish, then bring it back. */
+      thread_yield ();
+    }
+}
+
+/* Unpins the page at UPAGE, pinned by page_pin(). */
+static void
+page_unpin (struct hash *sup_page_table, const void *upage)
+{
+  struct sup_page_table_entry *spte = page_find (sup_page_table, upage);
+  ASSERT (spte != NULL);
+
+  lock_acquire (spte->lock);
+  ASSERT (spte->frame_entry != NULL);
+  frame_unpin (spte->frame_entry);
+  lock_release (spte->lock);
+}
+
+/* Brings the pages holding the SIZE bytes at USER_VADDR into frames,
+   for a read or, if WRITE, a write, and pins them there, so that the
+   kernel can copy to or from them without faulting.  The file system
+   needs this, since a fault taken while it holds an inode or buffer
+   cache lock may have to read or write the same file to bring the
+   page in.  Returns false, with nothing left pinned, if a page does
+   not exist or cannot be brought in. */
+bool
+page_pin_range (struct hash *sup_page_table, const void *user_vaddr,
+                size_t size, bool write)
+{
+  const void *first = pg_round_down (user_vaddr);
+  const void *page;
+
+  if (size == 0)
+    return true;
+  for (page = first; page <= user_vaddr + size - 1; page += PGSIZE)
+    if (!page_pin (sup_page_table, page, write))
+      {
+        while (page > first)
+          {
+            page -= PGSIZE;
+            page_unpin (sup_page_table, page);
+          }
+        return false;
+      }
+  return true;
+}
+
+/* Unpins the pages pinned by page_pin_range() for the SIZE bytes at
+   USER_VADDR. */
+void
+page_unpin_range (struct hash *sup_page_table, const void *user_vaddr,
+                  size_t size)
+{
+  const void *page;
+
+  if (size == 0)
+    return;
+  for (page = pg_round_down (user_vaddr); page <= user_vaddr + size - 1;
+       page += PGSIZE)
+    page_unpin (sup_page_table, page);
+}
@@ -75,5 +75,11 @@ struct sup_page_table_entry* page_pull (struct hash* sup_page_table,
 void page_unmap(struct sup_page_table_entry* spte);
 
 void page_evict(struct sup_page_table_entry* spte);
+bool page_is_clean(const struct sup_page_table_entry* spte);
+
+bool page_pin_range(struct hash* sup_page_table, const void* user_vaddr,
+    size_t size, bool write);
+void page_unpin_range(struct hash* sup_page_table, const void* user_vaddr,
+    size_t size);
 
 #endif
\ No newline at end of file
@@ -1,96 +1,219 @@
 #include "vm/swap.h"
+#include <string.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "vm/zswap.h"
 
 static struct block* swap_block;
+
+/* Pages are offered to the compressed pool first, and only go to
+   the swap device if they do not compress well or the pool is full.
+   The index of a page kept in the pool is its pool handle with
+   SWAP_IN_POOL set. */
+#define SWAP_IN_POOL ((size_t) 1 << (sizeof (size_t) * 8 - 1))
+
+/* Slots in use, and among them the slots whose page has been
+   written out completely.  Only ready slots are read around. */
 static struct bitmap* swap_bitmap;
+static struct bitmap* swap_ready;
+
+/* Process that each slot in use was evicted from. */
+static const void** swap_owner;
+
+/* Slot after the one allocated last.  Slots are handed out next-fit
+   from here, so pages evicted one after another, as the page-out
+   daemon does, land in consecutive slots and can be read back
+   together. */
+static size_t swap_cursor;
+
+/* Read-around.  When a page is read back from swap, the ready slots
+   that follow it, up to SWAP_CLUSTER - 1 of them and all from the
+   same process, are read in the same device request into AHEAD,
+   and the next swap_reclaim() of one of them is a copy.  AHEAD_SLOT
+   gives the slot held in each buffer, or BITMAP_ERROR; an entry is
+   dropped when its slot is freed.  AHEAD_BUSY is set while one
+   thread reads into AHEAD, and a hit on a buffer then is treated as
+   a miss. */
+#define SWAP_CLUSTER 8
+static uint8_t* ahead[SWAP_CLUSTER - 1];
+static size_t ahead_slot[SWAP_CLUSTER - 1];
+static bool ahead_busy;
+
+/* Protects everything above but SWAP_BLOCK.  Never held across
+   device I/O, which the block layer serializes itself. */
 static struct lock swap_lock;
 
 static size_t swap_size (void);
-static void read_from_block (const uint8_t *frame, size_t index);
-static void write_to_block (uint8_t* frame, size_t index);
+static void swap_io (size_t index, size_t page_cnt, uint8_t* const pages[],
+                     bool write);
+static void swap_forget (size_t index);
 
-void swap_init(void) 
+void swap_init(void)
 {
   swap_block = block_get_role(BLOCK_SWAP);
   swap_bitmap = bitmap_create(swap_size());
+  swap_ready = bitmap_create(swap_size());
+  swap_owner = calloc(swap_size(), sizeof *swap_owner);
+  if (swap_bitmap == NULL || swap_ready == NULL || swap_owner == NULL)
+    PANIC("swap table creation failed");
+  for (size_t i = 0; i < SWAP_CLUSTER - 1; i++)
+    {
+      ahead[i] = palloc_get_page(PAL_ASSERT);
+      ahead_slot[i] = BITMAP_ERROR;
+    }
   lock_init(&swap_lock);
+  zswap_init();
 }
 
 static size_t
-swap_size(void) 
+swap_size(void)
 {
   return block_size(swap_block) / PAGE_BLOCK_SIZE;
 }
 
+/* Reads or writes the PAGE_CNT pages in PAGES from or to the
+   consecutive slots starting at INDEX, as a single device request. */
 static void
-read_from_block (const uint8_t *frame, size_t index)
+swap_io (size_t index, size_t page_cnt, uint8_t* const pages[], bool write)
 {
-  ASSERT(frame != NULL);
-  ASSERT(index < swap_size());
-  ASSERT(index != BITMAP_ERROR);
-  ASSERT(bitmap_test(swap_bitmap, index));
+  void* buffers[SWAP_CLUSTER * PAGE_BLOCK_SIZE];
 
-  lock_acquire(&swap_lock);
-  for (size_t i = 0; i < PAGE_BLOCK_SIZE; i++) 
-    {
-        block_read(swap_block, PAGE_BLOCK_SIZE * index + i, 
-            frame + (i * BLOCK_SECTOR_SIZE));
-    }
-  lock_release(&swap_lock);
+  ASSERT(page_cnt > 0 && page_cnt <= SWAP_CLUSTER);
+  ASSERT(index + page_cnt <= swap_size());
+
+  for (size_t i = 0; i < page_cnt * PAGE_BLOCK_SIZE; i++)
+    buffers[i] = pages[i / PAGE_BLOCK_SIZE]
+                 + (i % PAGE_BLOCK_SIZE) * BLOCK_SECTOR_SIZE;
+  if (write)
+    block_write_multiple(swap_block, PAGE_BLOCK_SIZE * index,
+                         page_cnt * PAGE_BLOCK_SIZE,
+                         (const void* const*) buffers);
+  else
+    block_read_multiple(swap_block, PAGE_BLOCK_SIZE * index,
+                        page_cnt * PAGE_BLOCK_SIZE, buffers);
 }
 
-static void
-write_to_block(uint8_t* frame, size_t index)
+/* Writes FRAME, a page of process OWNER, to the compressed pool or
+   a free slot and returns its index. */
+size_t
+swap_evict(uint8_t* frame, const void* owner)
 {
+  size_t handle;
+
   ASSERT(frame != NULL);
-  ASSERT(index < swap_size());
-  ASSERT(index != BITMAP_ERROR);
-  ASSERT(bitmap_test(swap_bitmap, index));
+
+  if (zswap_store(frame, &handle))
+    return SWAP_IN_POOL | handle;
 
   lock_acquire(&swap_lock);
-  for (int i = 0; i < PAGE_BLOCK_SIZE; i++) 
-    {
-        block_write(swap_block, PAGE_BLOCK_SIZE * index + i, frame + (i * BLOCK_SECTOR_SIZE));
-    }
+  size_t index = bitmap_scan_and_flip(swap_bitmap, swap_cursor, 1, false);
+  if (index == BITMAP_ERROR)
+    index = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
+  if (index == BITMAP_ERROR)
+    PANIC("out of swap space");
+  swap_cursor = index + 1;
+  swap_owner[index] = owner;
   lock_release(&swap_lock);
-}
 
-size_t 
-swap_evict(uint8_t* frame) 
-{
-  ASSERT(frame != NULL);
+  swap_io(index, 1, &frame, true);
 
   lock_acquire(&swap_lock);
-  size_t index = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
-  ASSERT(index != BITMAP_ERROR);
+  bitmap_mark(swap_ready, index);
   lock_release(&swap_lock);
-
-  write_to_block(frame, index);
   return index;
 }
 
+/* Reads the page at INDEX into FRAME and frees its space. */
 void
-swap_reclaim(uint8_t* frame, size_t index) 
+swap_reclaim(uint8_t* frame, size_t index)
 {
+  uint8_t* pages[SWAP_CLUSTER];
+  size_t page_cnt = 1;
+  bool around = false;
+
   ASSERT(frame != NULL);
+  if (index & SWAP_IN_POOL)
+    {
+      zswap_load(frame, index & ~SWAP_IN_POOL);
+      return;
+    }
   ASSERT(index < swap_size());
+
+  lock_acquire(&swap_lock);
   ASSERT(bitmap_test(swap_bitmap, index));
+  for (size_t i = 0; i < SWAP_CLUSTER - 1; i++)
+    if (ahead_slot[i] == index)
+      {
+        ahead_slot[i] = BITMAP_ERROR;
+        if (!ahead_busy)
+          {
+            memcpy(frame, ahead[i], PGSIZE);
+            swap_forget(index);
+            lock_release(&swap_lock);
+            return;
+          }
+      }
+
+  /* Read around INDEX if the buffers are free. */
+  pages[0] = frame;
+  if (!ahead_busy)
+    {
+      while (page_cnt < SWAP_CLUSTER && index + page_cnt < swap_size()
+             && bitmap_test(swap_ready, index + page_cnt)
+             && swap_owner[index + page_cnt] == swap_owner[index])
+        page_cnt++;
+      if (page_cnt > 1)
+        {
+          for (size_t i = 0; i < SWAP_CLUSTER - 1; i++)
+            {
+              ahead_slot[i] = i + 1 < page_cnt ? index + i + 1 : BITMAP_ERROR;
+              pages[i + 1] = ahead[i];
+            }
+          around = ahead_busy = true;
+        }
+    }
+  lock_release(&swap_lock);
+
+  swap_io(index, page_cnt, pages, false);
 
-  read_from_block(frame, index);
   lock_acquire(&swap_lock);
-  bitmap_reset(swap_bitmap, index);
+  if (around)
+    ahead_busy = false;
+  swap_forget(index);
   lock_release(&swap_lock);
 }
 
+/* Frees the space of the page at INDEX without reading it. */
 void
-swap_free(size_t index) 
+swap_free(size_t index)
 {
+  if (index & SWAP_IN_POOL)
+    {
+      zswap_free(index & ~SWAP_IN_POOL);
+      return;
+    }
   ASSERT(index < swap_size());
-  ASSERT(bitmap_test(swap_bitmap, index));
 
   lock_acquire(&swap_lock);
-  bitmap_reset(swap_bitmap, index);
+  ASSERT(bitmap_test(swap_bitmap, index));
+  for (size_t i = 0; i < SWAP_CLUSTER - 1; i++)
+    if (ahead_slot[i] == index)
+      ahead_slot[i] = BITMAP_ERROR;
+  swap_forget(index);
   lock_release(&swap_lock);
-}
\ No newline at end of file
+}
+
+/* Marks slot INDEX free.  The caller must hold swap_lock and have
+   dropped any read-around buffer holding it. */
+static void
+swap_forget(size_t index)
+{
+  ASSERT(lock_held_by_current_thread(&swap_lock));
+
+  bitmap_reset(swap_bitmap, index);
+  bitmap_reset(swap_ready, index);
+  swap_owner[index] = NULL;
+}
@@ -7,7 +7,7 @@
 
 void swap_init(void);
 
-size_t swap_evict(uint8_t* frame);
+size_t swap_evict(uint8_t* frame, const void* owner);
 void swap_reclaim(uint8_t* frame, size_t index);
 void swap_free(size_t index);
 
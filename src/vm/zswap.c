@@ -0,0 +1,421 @@
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap pool.  Evicted pages that compress well are kept
+   here, in kernel memory, instead of being written to the swap
+   device; reading one back is a decompression instead of a device
+   request.  Each page is compressed on its own and stored in a slot
+   of a page set aside for the pool, so a page is only kept if it
+   shrinks to ZSWAP_MAX_SIZE, a quarter of a page, or less.  All-zero
+   pages take no slot at all. */
+#define ZSWAP_MAX_SIZE (PGSIZE / 4)
+
+/* Share of the kernel pool, at start-up, that the pool's pages may
+   take: one part in ZSWAP_POOL_DIV.  Once they are all in use,
+   pages go to the swap device. */
+#define ZSWAP_POOL_DIV 8
+
+/* Pool pages are each split into equal slots of one size class, a
+   power of two from ZSWAP_MIN_SLOT to ZSWAP_MAX_SIZE, and a page is
+   stored in the smallest class it fits.  Whole pages are what count
+   against the limit, so partly used pages are paid for in full and
+   the pool never holds more than its share.  A page is given back
+   as soon as its last slot is freed. */
+#define ZSWAP_MIN_SLOT (ZSWAP_MAX_SIZE / 4)
+#define ZSWAP_CLASS_CNT 3
+#define ZSWAP_SLOT_CNT (PGSIZE / ZSWAP_MIN_SLOT)  /* Most per page. */
+
+struct zswap_page
+  {
+    uint8_t* base;              /* The page. */
+    size_t slot_size;           /* Size of each of its slots. */
+    uint16_t used;              /* Bit I set if slot I is in use. */
+    struct list_elem elem;      /* In its class's list, if not full. */
+  };
+
+/* A stored page, in a slot of PAGE starting at DATA, or, if PAGE is
+   null, an all-zero page. */
+struct zswap_entry
+  {
+    struct zswap_page* page;
+    uint8_t* data;
+    uint16_t size;
+  };
+
+static struct zswap_entry* zswap_table;
+static struct bitmap* zswap_used;       /* Handles in use. */
+static struct list zswap_partial[ZSWAP_CLASS_CNT]; /* Pages not full. */
+static size_t zswap_page_cnt;           /* Pages held. */
+static size_t zswap_max_pages;          /* Limit on ZSWAP_PAGE_CNT. */
+static struct lock zswap_lock;          /* Protects the above. */
+
+/* The compressor's hash table and output buffer, and the lock that
+   lets one page at a time use them; they are too big for a kernel
+   stack.  Taken before ZSWAP_LOCK when both are held. */
+#define LZ_HASH_BITS 10
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+static uint8_t lz_buffer[ZSWAP_MAX_SIZE];
+static struct lock lz_lock;
+
+static size_t lz_compress(const uint8_t* src, uint8_t* dst, size_t dst_size);
+static void lz_decompress(const uint8_t* src, size_t size, uint8_t* dst);
+
+void
+zswap_init(void)
+{
+  size_t cnt;
+
+  /* Enough handles for a full pool of pages compressed sixteen to
+     one, into the smallest slots; zero pages, which take no slot,
+     are held to that too. */
+  zswap_max_pages = palloc_free_cnt(0) / ZSWAP_POOL_DIV;
+  cnt = zswap_max_pages * ZSWAP_SLOT_CNT;
+  zswap_table = malloc(cnt * sizeof *zswap_table);
+  zswap_used = bitmap_create(cnt);
+  if (zswap_table == NULL || zswap_used == NULL)
+    PANIC("compressed swap pool creation failed");
+  for (size_t i = 0; i < ZSWAP_CLASS_CNT; i++)
+    list_init(&zswap_partial[i]);
+  lock_init(&zswap_lock);
+  lock_init(&lz_lock);
+}
+
+/* Takes a slot of at least SIZE bytes for entry E, setting its PAGE
+   and DATA.  Returns false if it would take a page beyond the pool's
+   share, or no page can be had. */
+static bool
+slot_alloc(struct zswap_entry* e, size_t size)
+{
+  size_t class = 0, slot_size = ZSWAP_MIN_SLOT;
+  struct zswap_page* zp;
+  size_t slot;
+
+  ASSERT(lock_held_by_current_thread(&zswap_lock));
+  ASSERT(size > 0 && size <= ZSWAP_MAX_SIZE);
+
+  while (slot_size < size)
+    {
+      slot_size *= 2;
+      class++;
+    }
+
+  if (!list_empty(&zswap_partial[class]))
+    zp = list_entry(list_front(&zswap_partial[class]),
+                    struct zswap_page, elem);
+  else
+    {
+      if (zswap_page_cnt >= zswap_max_pages)
+        return false;
+      zp = malloc(sizeof *zp);
+      if (zp == NULL)
+        return false;
+      zp->base = palloc_get_page(0);
+      if (zp->base == NULL)
+        {
+          free(zp);
+          return false;
+        }
+      zp->slot_size = slot_size;
+      zp->used = 0;
+      list_push_front(&zswap_partial[class], &zp->elem);
+      zswap_page_cnt++;
+    }
+
+  for (slot = 0; zp->used & (1u << slot); slot++)
+    continue;
+  zp->used |= 1u << slot;
+  if (zp->used == (1u << PGSIZE / slot_size) - 1)
+    list_remove(&zp->elem);
+
+  e->page = zp;
+  e->data = zp->base + slot * slot_size;
+  return true;
+}
+
+/* Frees the slot of entry E, and its page if that was the last slot
+   in use. */
+static void
+slot_free(const struct zswap_entry* e)
+{
+  struct zswap_page* zp = e->page;
+  size_t class = 0, slot_size = ZSWAP_MIN_SLOT;
+
+  ASSERT(lock_held_by_current_thread(&zswap_lock));
+
+  if (zp == NULL)
+    return;
+  while (slot_size < zp->slot_size)
+    {
+      slot_size *= 2;
+      class++;
+    }
+
+  if (zp->used == (1u << PGSIZE / zp->slot_size) - 1)
+    list_push_front(&zswap_partial[class], &zp->elem);
+  zp->used &= ~(1u << (e->data - zp->base) / zp->slot_size);
+  if (zp->used == 0)
+    {
+      list_remove(&zp->elem);
+      palloc_free_page(zp->base);
+      free(zp);
+      zswap_page_cnt--;
+    }
+}
+
+/* Returns true if PAGE is all zeros. */
+static bool
+is_zero_page(const uint8_t* page)
+{
+  const uint32_t* word = (const uint32_t*) page;
+
+  for (size_t i = 0; i < PGSIZE / sizeof *word; i++)
+    if (word[i] != 0)
+      return false;
+  return true;
+}
+
+/* Compresses PAGE into the pool and stores its handle in *HANDLE.
+   Returns false, storing nothing, if PAGE does not compress well
+   enough or the pool is full. */
+bool
+zswap_store(const uint8_t* page, size_t* handle)
+{
+  struct zswap_entry e = { NULL, NULL, 0 };
+  bool zero;
+
+  ASSERT(page != NULL);
+
+  zero = is_zero_page(page);
+  if (!zero)
+    {
+      lock_acquire(&lz_lock);
+      e.size = lz_compress(page, lz_buffer, sizeof lz_buffer);
+      if (e.size == 0)
+        {
+          lock_release(&lz_lock);
+          return false;
+        }
+    }
+
+  lock_acquire(&zswap_lock);
+  size_t idx = bitmap_scan(zswap_used, 0, 1, false);
+  if (idx != BITMAP_ERROR && (zero || slot_alloc(&e, e.size)))
+    {
+      if (!zero)
+        memcpy(e.data, lz_buffer, e.size);
+      bitmap_mark(zswap_used, idx);
+      zswap_table[idx] = e;
+    }
+  else
+    idx = BITMAP_ERROR;
+  lock_release(&zswap_lock);
+  if (!zero)
+    lock_release(&lz_lock);
+
+  if (idx == BITMAP_ERROR)
+    return false;
+  *handle = idx;
+  return true;
+}
+
+/* Removes the page with HANDLE from the pool and decompresses it
+   into PAGE. */
+void
+zswap_load(uint8_t* page, size_t handle)
+{
+  struct zswap_entry e;
+
+  ASSERT(page != NULL);
+
+  /* The slot stays taken while we read it without the lock. */
+  lock_acquire(&zswap_lock);
+  ASSERT(bitmap_test(zswap_used, handle));
+  e = zswap_table[handle];
+  bitmap_reset(zswap_used, handle);
+  lock_release(&zswap_lock);
+
+  if (e.page == NULL)
+    memset(page, 0, PGSIZE);
+  else
+    {
+      lz_decompress(e.data, e.size, page);
+      lock_acquire(&zswap_lock);
+      slot_free(&e);
+      lock_release(&zswap_lock);
+    }
+}
+
+/* Removes the page with HANDLE from the pool. */
+void
+zswap_free(size_t handle)
+{
+  lock_acquire(&zswap_lock);
+  ASSERT(bitmap_test(zswap_used, handle));
+  slot_free(&zswap_table[handle]);
+  bitmap_reset(zswap_used, handle);
+  lock_release(&zswap_lock);
+}
+
+/* Compressor.  A byte-oriented LZ77 in the manner of LZ4: the output
+   is a series of sequences, each a token byte whose high nibble is
+   the number of literal bytes that follow it and whose low nibble is
+   the length of the match after them, less LZ_MIN_MATCH.  A nibble
+   of 15 is continued by bytes that add to it, up to the first that
+   is not 255.  The literals are followed by the match's distance
+   back, two bytes little-endian, and its length bytes.  The last
+   sequence has only literals.  Matches are found through a hash of
+   the next LZ_MIN_MATCH bytes, remembering the last position each
+   hash was seen at. */
+#define LZ_MIN_MATCH 4
+
+static uint32_t
+lz_read32(const uint8_t* p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static unsigned
+lz_hash(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends the length continuation bytes for LEN, which has already
+   been reduced by 15, at *OP. */
+static uint8_t*
+lz_put_length(uint8_t* op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/* Appends a sequence of the LIT_CNT literals at LIT and then, if
+   MATCH_LEN is nonzero, a match of MATCH_LEN bytes OFFSET bytes back,
+   at OP.  Returns the new end of the output, or a null pointer if it
+   would pass OEND. */
+static uint8_t*
+lz_put_sequence(uint8_t* op, uint8_t* oend, const uint8_t* lit,
+                size_t lit_cnt, size_t offset, size_t match_len)
+{
+  size_t m = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+  if ((size_t) (oend - op) < 1 + lit_cnt / 255 + 1 + lit_cnt + 2
+                             + m / 255 + 1)
+    return NULL;
+
+  *op++ = ((lit_cnt < 15 ? lit_cnt : 15) << 4) | (m < 15 ? m : 15);
+  if (lit_cnt >= 15)
+    op = lz_put_length(op, lit_cnt - 15);
+  memcpy(op, lit, lit_cnt);
+  op += lit_cnt;
+  if (match_len > 0)
+    {
+      *op++ = offset & 0xff;
+      *op++ = offset >> 8;
+      if (m >= 15)
+        op = lz_put_length(op, m - 15);
+    }
+  return op;
+}
+
+/* Compresses the page at SRC into the DST_SIZE bytes at DST.
+   Returns the compressed size, or 0 if it does not fit. */
+static size_t
+lz_compress(const uint8_t* src, uint8_t* dst, size_t dst_size)
+{
+  const uint8_t* ip = src;
+  const uint8_t* anchor = src;
+  const uint8_t* end = src + PGSIZE;
+  uint8_t* op = dst;
+  uint8_t* oend = dst + dst_size;
+
+  memset(lz_table, 0, sizeof lz_table);
+  while (ip + LZ_MIN_MATCH <= end)
+    {
+      uint32_t seq = lz_read32(ip);
+      unsigned h = lz_hash(seq);
+      const uint8_t* cand = src + lz_table[h];
+
+      lz_table[h] = ip - src;
+      if (cand >= ip || lz_read32(cand) != seq)
+        {
+          ip++;
+          continue;
+        }
+
+      size_t len = LZ_MIN_MATCH;
+      while (ip + len < end && cand[len] == ip[len])
+        len++;
+      op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - cand, len);
+      if (op == NULL)
+        return 0;
+      ip += len;
+      anchor = ip;
+    }
+
+  op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0);
+  return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+/* Reads a length continued past a nibble of 15 from *IP. */
+static size_t
+lz_get_length(const uint8_t** ip)
+{
+  size_t len = 0;
+  uint8_t b;
+
+  do
+    {
+      b = *(*ip)++;
+      len += b;
+    }
+  while (b == 255);
+  return len;
+}
+
+/* Decompresses the SIZE bytes at SRC, made by lz_compress(), into
+   the page at DST. */
+static void
+lz_decompress(const uint8_t* src, size_t size, uint8_t* dst)
+{
+  const uint8_t* ip = src;
+  const uint8_t* iend = src + size;
+  uint8_t* op = dst;
+
+  while (true)
+    {
+      uint8_t token = *ip++;
+      size_t lit_cnt = token >> 4;
+      if (lit_cnt == 15)
+        lit_cnt += lz_get_length(&ip);
+      memcpy(op, ip, lit_cnt);
+      op += lit_cnt;
+      ip += lit_cnt;
+      if (ip >= iend)
+        break;
+
+      size_t offset = ip[0] | (ip[1] << 8);
+      size_t len = token & 15;
+      ip += 2;
+      if (len == 15)
+        len += lz_get_length(&ip);
+      len += LZ_MIN_MATCH;
+
+      /* Byte by byte, since the match may overlap its own output. */
+      const uint8_t* match = op - offset;
+      while (len-- > 0)
+        *op++ = *match++;
+    }
+  ASSERT(op == dst + PGSIZE);
+}
@@ -0,0 +1,14 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+void zswap_init(void);
+
+bool zswap_store(const uint8_t* page, size_t* handle);
+void zswap_load(uint8_t* page, size_t handle);
+void zswap_free(size_t handle);
+
+#endif // VM_ZSWAP_H